@@ -13,11 +13,11 @@ layout(std140, binding = 0) uniform PerFrameData
 	vec4 lightDirection;
 };
 
+// packed to 8 bytes, see TileData in TileMesh.h
 struct TileData
 {
-	vec4 position;
-	uint tileTemplateIndex;
-	uint tileVariantIndex;
+	uint cell;
+	uint bits;
 };
 
 layout(std430, binding = 1) restrict readonly buffer Tiles
@@ -25,11 +25,17 @@ layout(std430, binding = 1) restrict readonly buffer Tiles
 	TileData in_tiles[];
 };
 
+uint getTileTemplateIndex(TileData tileData)
+{
+	return bitfieldExtract(tileData.bits, 15, 8);
+}
+
 struct TileTemplateData
 {
 	uint64_t albedoTexture;
 	int numVariants;
 	int numAnimationFrames;
+	uint flags;
 };
 
 layout(std430, binding = 2) restrict readonly buffer TileTemplates
@@ -39,10 +45,13 @@ layout(std430, binding = 2) restrict readonly buffer TileTemplates
 
 layout (location = 0) in vec3 in_Normal;
 layout (location = 1) in vec2 in_Uv;
-layout (location = 2) in flat int in_BaseInstance;
+layout (location = 2) in flat int in_TileIndex;
 
 layout (location = 0) out vec4 out_FragColor;
 
+// the opaque pass runs without blending and discards the cutout edges of the sprites instead
+layout (location = 0) uniform bool alphaTest;
+
 float random( vec2 p )
 {
     vec2 K1 = vec2(
@@ -59,8 +68,8 @@ float remap(float value, float min1, float max1, float min2, float max2)
 
 void main()
 {
-	TileData tileData = in_tiles[in_BaseInstance];
-	TileTemplateData tileTemplateData = in_tileTemplates[tileData.tileTemplateIndex];
+	TileData tileData = in_tiles[in_TileIndex];
+	TileTemplateData tileTemplateData = in_tileTemplates[getTileTemplateIndex(tileData)];
 
 	// pick grass or dirt color based on normal
 	//vec4 textureColor = in_Normal.z > 0.5 ? grassColor : dirtColor;
@@ -72,6 +81,15 @@ void main()
 	//vec4 color = vec4(textureColor.rgb + (random(gl_FragCoord.xy) * 0.1 - 0.05), textureColor.a);
 	vec4 color = textureColor;
 
+	if (alphaTest)
+	{
+		if (color.a < 0.5)
+		{
+			discard;
+		}
+		color.a = 1.0;
+	}
+
 	// apply shadow
 	float dotNormalLightDirection = dot(in_Normal, lightDirection.xyz);
 	float shadowFactor = remap(clamp(-dotNormalLightDirection, 0.0, 1.0), 0.0, 1.0, 0.7, 1.0);
@@ -12,11 +12,11 @@ layout(std140, binding = 0) uniform PerFrameData
 	vec4 lightDirection;
 };
 
+// packed to 8 bytes, see TileData in TileMesh.h
 struct TileData
 {
-	vec4 position;
-	uint tileTemplateIndex;
-	uint tileVariantIndex;
+	uint cell;
+	uint bits;
 };
 
 layout(std430, binding = 1) restrict readonly buffer Tiles
@@ -24,11 +24,33 @@ layout(std430, binding = 1) restrict readonly buffer Tiles
 	TileData in_tiles[];
 };
 
+float getTileHeight(TileData tileData)
+{
+	return float(bitfieldExtract(int(tileData.bits), 0, 15)) / 128.0;
+}
+
+uint getTileTemplateIndex(TileData tileData)
+{
+	return bitfieldExtract(tileData.bits, 15, 8);
+}
+
+uint getTileVariantIndex(TileData tileData)
+{
+	return bitfieldExtract(tileData.bits, 23, 5);
+}
+
+vec3 getTilePosition(TileData tileData)
+{
+	ivec2 cell = ivec2(bitfieldExtract(int(tileData.cell), 0, 16), bitfieldExtract(int(tileData.cell), 16, 16));
+	return vec3(vec2(cell), getTileHeight(tileData));
+}
+
 struct TileTemplateData
 {
 	uint64_t albedoTexture;
 	int numVariants;
 	int numAnimationFrames;
+	uint flags;
 };
 
 layout(std430, binding = 2) restrict readonly buffer TileTemplates
@@ -36,22 +58,40 @@ layout(std430, binding = 2) restrict readonly buffer TileTemplates
 	TileTemplateData in_tileTemplates[];
 };
 
-layout (location = 0) in vec3 in_Vertex;
-layout (location = 1) in vec3 in_Normal;
-layout (location = 2) in vec2 in_Uv;
+// indices of the tiles that passed culling, packed per draw group
+layout(std430, binding = 3) restrict readonly buffer Instances
+{
+	uint in_instances[];
+};
+
+// TileVertexCount vertices for each template, read by gl_VertexID which includes the base vertex
+struct TileVertex
+{
+	vec4 position;
+	vec4 normal;
+	vec2 uv;
+};
+
+layout(std430, binding = 14) restrict readonly buffer TileVertices
+{
+	TileVertex in_tileVertices[];
+};
 
 layout (location = 0) out vec3 out_Normal;
 layout (location = 1) out vec2 out_Uv;
-layout (location = 2) out flat int out_BaseInstance;
+layout (location = 2) out flat int out_TileIndex;
 
 void main()
 {
-	TileData tileData = in_tiles[gl_BaseInstance];
-	TileTemplateData tileTemplateData = in_tileTemplates[tileData.tileTemplateIndex];
+	int tileIndex = int(in_instances[gl_BaseInstance + gl_InstanceID]);
+	TileData tileData = in_tiles[tileIndex];
+	TileTemplateData tileTemplateData = in_tileTemplates[getTileTemplateIndex(tileData)];
+	// the base vertex of the draw group points at the vertices of its template
+	TileVertex tileVertex = in_tileVertices[gl_VertexID];
 	
 	mat4 mvp = projection * view;
-	gl_Position = mvp * vec4(in_Vertex + tileData.position.xyz, 1.0);
-	out_Normal = in_Normal;
-	out_Uv = vec2(in_Uv.x, in_Uv.y + float(tileData.tileVariantIndex) / tileTemplateData.numVariants);
-	out_BaseInstance = gl_BaseInstance;
+	gl_Position = mvp * vec4(tileVertex.position.xyz + getTilePosition(tileData), 1.0);
+	out_Normal = tileVertex.normal.xyz;
+	out_Uv = vec2(tileVertex.uv.x, tileVertex.uv.y + float(getTileVariantIndex(tileData)) / tileTemplateData.numVariants);
+	out_TileIndex = tileIndex;
 }
@@ -0,0 +1,65 @@
+//
+#version 460 core
+
+#extension GL_ARB_bindless_texture : require
+#extension GL_ARB_gpu_shader_int64 : enable
+
+layout(std140, binding = 0) uniform PerFrameData
+{
+	mat4 view;
+	mat4 projection;
+	vec4 grassColor;
+	vec4 dirtColor;
+	vec4 lightDirection;
+};
+
+struct TileTemplateData
+{
+	uint64_t albedoTexture;
+	int numVariants;
+	int numAnimationFrames;
+	uint flags;
+};
+
+layout(std430, binding = 2) restrict readonly buffer TileTemplates
+{
+	TileTemplateData in_tileTemplates[];
+};
+
+layout (location = 0) in vec3 in_Normal;
+layout (location = 1) in vec2 in_TileCoords;
+layout (location = 2) in flat uint in_TileTemplateIndex;
+// affine mapping from the tile coordinates of a single tile top to its uv in the sprite
+layout (location = 3) in flat vec2 in_TopUvOrigin;
+layout (location = 4) in flat vec2 in_TopUvAxisX;
+layout (location = 5) in flat vec2 in_TopUvAxisY;
+
+layout (location = 0) out vec4 out_FragColor;
+
+float remap(float value, float min1, float max1, float min2, float max2)
+{
+	return min2 + (value - min1) * (max2 - min2) / (max1 - min1);
+}
+
+void main()
+{
+	TileTemplateData tileTemplateData = in_tileTemplates[in_TileTemplateIndex];
+
+	// the tile top repeats over the rectangle, the gradients are taken before wrapping to avoid seams
+	vec2 repeatedCoords = fract(in_TileCoords);
+	vec2 uv = in_TopUvOrigin + repeatedCoords.x * in_TopUvAxisX + repeatedCoords.y * in_TopUvAxisY;
+	vec2 unwrappedUv = in_TileCoords.x * in_TopUvAxisX + in_TileCoords.y * in_TopUvAxisY;
+	vec4 color = textureGrad(sampler2D(unpackUint2x32(tileTemplateData.albedoTexture)), uv, dFdx(unwrappedUv), dFdy(unwrappedUv));
+
+	// merged tops are opaque only
+	if (color.a < 0.5)
+	{
+		discard;
+	}
+	color.a = 1.0;
+
+	// apply shadow
+	float dotNormalLightDirection = dot(in_Normal, lightDirection.xyz);
+	float shadowFactor = remap(clamp(-dotNormalLightDirection, 0.0, 1.0), 0.0, 1.0, 0.7, 1.0);
+	out_FragColor = vec4(color.rgb * shadowFactor, color.a);
+}
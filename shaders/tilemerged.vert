@@ -0,0 +1,92 @@
+//
+#version 460 core
+
+#extension GL_ARB_gpu_shader_int64 : enable
+
+layout(std140, binding = 0) uniform PerFrameData
+{
+	mat4 view;
+	mat4 projection;
+	vec4 grassColor;
+	vec4 dirtColor;
+	vec4 lightDirection;
+};
+
+struct TileTemplateData
+{
+	uint64_t albedoTexture;
+	int numVariants;
+	int numAnimationFrames;
+	uint flags;
+};
+
+layout(std430, binding = 2) restrict readonly buffer TileTemplates
+{
+	TileTemplateData in_tileTemplates[];
+};
+
+// a rectangle of coplanar tile tops, origin is the center of its first tile
+struct MergedTopData
+{
+	vec4 origin;
+	vec2 size;
+	uint tileTemplateIndex;
+	uint tileVariantIndex;
+};
+
+layout(std430, binding = 12) restrict readonly buffer MergedTops
+{
+	MergedTopData in_mergedTops[];
+};
+
+// indices of the merged tops of the visible clusters
+layout(std430, binding = 13) restrict readonly buffer MergedTopInstances
+{
+	uint in_mergedTopInstances[];
+};
+
+// TileVertexCount vertices for each template, read by gl_VertexID
+struct TileVertex
+{
+	vec4 position;
+	vec4 normal;
+	vec2 uv;
+};
+
+layout(std430, binding = 14) restrict readonly buffer TileVertices
+{
+	TileVertex in_tileVertices[];
+};
+
+const int TileVertexCount = 12;
+
+layout (location = 0) out vec3 out_Normal;
+layout (location = 1) out vec2 out_TileCoords;
+layout (location = 2) out flat uint out_TileTemplateIndex;
+layout (location = 3) out flat vec2 out_TopUvOrigin;
+layout (location = 4) out flat vec2 out_TopUvAxisX;
+layout (location = 5) out flat vec2 out_TopUvAxisY;
+
+void main()
+{
+	MergedTopData mergedTop = in_mergedTops[in_mergedTopInstances[gl_BaseInstance + gl_InstanceID]];
+	TileTemplateData tileTemplateData = in_tileTemplates[mergedTop.tileTemplateIndex];
+	int firstTileVertex = int(mergedTop.tileTemplateIndex) * TileVertexCount;
+	TileVertex tileVertex = in_tileVertices[firstTileVertex + gl_VertexID];
+
+	// the unit tile top is stretched over the rectangle, the tile coordinates repeat once per tile
+	vec2 tileCoords = (tileVertex.position.xy + 0.5) * mergedTop.size;
+	vec3 position = mergedTop.origin.xyz + vec3(tileCoords - 0.5, tileVertex.position.z);
+
+	mat4 mvp = projection * view;
+	gl_Position = mvp * vec4(position, 1.0);
+	out_Normal = tileVertex.normal.xyz;
+	out_TileCoords = tileCoords;
+	out_TileTemplateIndex = mergedTop.tileTemplateIndex;
+
+	// the uv of the top vertices are an affine mapping of the tile top
+	vec2 variantOffset = vec2(0.0, float(mergedTop.tileVariantIndex) / tileTemplateData.numVariants);
+	out_TopUvOrigin = in_tileVertices[firstTileVertex].uv + variantOffset;
+	out_TopUvAxisX = in_tileVertices[firstTileVertex + 1].uv - in_tileVertices[firstTileVertex].uv;
+	out_TopUvAxisY = in_tileVertices[firstTileVertex + 2].uv - in_tileVertices[firstTileVertex].uv;
+}
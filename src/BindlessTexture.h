@@ -5,6 +5,9 @@
 #include <GL/glew.h>
 #include <SDL2/SDL_image.h>
 
+#include "MemoryRegistry.h"
+#include "UploadQueue.h"
+
 class BindlessTexture
 {
 public:
@@ -14,40 +17,86 @@ public:
 	void operator=(const BindlessTexture&) = delete;
 	void operator=(BindlessTexture&&) = delete;
 
-	BindlessTexture(const std::string& filePath)
+	// texture handle residency is per context, a texture loaded on another thread
+	// has to be made resident later from the render thread
+	BindlessTexture(const std::string& filePath, bool makeResident = true)
+		: m_filePath(filePath)
+		, m_resident(false)
 	{
 		SDL_Surface* surface = IMG_Load(filePath.c_str());
 		assert(surface != nullptr);
 
-		m_size.x = surface->w;
-		m_size.y = surface->h;
-
-		glCreateTextures(GL_TEXTURE_2D, 1, &m_handle);
-		glTextureParameteri(m_handle, GL_TEXTURE_MAX_LEVEL, 0);
-		glTextureParameteri(m_handle, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glTextureParameteri(m_handle, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-		glTextureStorage2D(m_handle, 1, GL_RGBA8, surface->w, surface->h);
+		allocateStorage(surface->w, surface->h);
 		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 		glTextureSubImage2D(m_handle, 0, 0, 0, surface->w, surface->h, GL_RGBA, GL_UNSIGNED_BYTE, surface->pixels);
-		glBindTextures(0, 1, &m_handle);
-
-		m_handleBindless = glGetTextureHandleARB(m_handle);
-		glMakeTextureHandleResidentARB(m_handleBindless);
+		GLMemoryRegistry::getInstance().addUpload(m_filePath, getStorageSize());
+		createHandle(makeResident);
 
 		SDL_FreeSurface(surface);
 	}
 
+	// the pixels of an image decoded by the caller, typically on a loader thread, are copied and streamed through
+	// the queue over the next frames, the texture can be drawn meanwhile and the image freed right away
+	BindlessTexture(const std::string& filePath, const SDL_Surface& image, GLUploadQueue& uploadQueue, bool makeResident = true)
+		: m_filePath(filePath)
+		, m_resident(false)
+	{
+		allocateStorage(image.w, image.h);
+		uploadQueue.enqueueTexture2D(m_handle, m_filePath, image.w, image.h, GL_RGBA, GL_UNSIGNED_BYTE, 4, image.pixels);
+		createHandle(makeResident);
+	}
+
 	~BindlessTexture()
 	{
-		glMakeTextureHandleNonResidentARB(m_handleBindless);
+		if (m_resident)
+		{
+			glMakeTextureHandleNonResidentARB(m_handleBindless);
+		}
 		glDeleteTextures(1, &m_handle);
+		GLMemoryRegistry::getInstance().removeAllocation(m_filePath, getStorageSize());
+	}
+
+	void makeHandleResident()
+	{
+		assert(!m_resident);
+		glMakeTextureHandleResidentARB(m_handleBindless);
+		m_resident = true;
 	}
 
 	GLuint64 getHandleBindless() const { return m_handleBindless; }
 	const glm::ivec2& getSize() const { return m_size; }
+	GLsizeiptr getStorageSize() const { return static_cast<GLsizeiptr>(m_size.x) * m_size.y * 4; }
+
+protected:
+	void allocateStorage(int width, int height)
+	{
+		m_size.x = width;
+		m_size.y = height;
+
+		glCreateTextures(GL_TEXTURE_2D, 1, &m_handle);
+		glTextureParameteri(m_handle, GL_TEXTURE_MAX_LEVEL, 0);
+		glTextureParameteri(m_handle, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTextureParameteri(m_handle, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTextureStorage2D(m_handle, 1, GL_RGBA8, width, height);
+		GLMemoryRegistry::getInstance().addAllocation(m_filePath, getStorageSize());
+	}
+
+	// the parameters of the texture can't change once it has a bindless handle, its pixels still can
+	void createHandle(bool makeResident)
+	{
+		glBindTextures(0, 1, &m_handle);
+
+		m_handleBindless = glGetTextureHandleARB(m_handle);
+		if (makeResident)
+		{
+			makeHandleResident();
+		}
+	}
 
 protected:
+	std::string m_filePath;
 	GLuint m_handle;
 	GLuint64 m_handleBindless;
 	glm::ivec2 m_size;
+	bool m_resident;
 };
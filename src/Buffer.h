@@ -1,7 +1,20 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
 #include <GL/glew.h>
 
+#include "MemoryRegistry.h"
+
 struct DrawElementsIndirectCommand
 {
 	GLuint count;
@@ -15,12 +28,18 @@ class GLBufferBase
 {
 public:
 	GLBufferBase()
+		: m_name("unnamed buffer")
+		, m_storageSize(0)
 	{
 		glCreateBuffers(1, &m_handle);
 	}
 
 	~GLBufferBase()
 	{
+		if (m_storageSize > 0)
+		{
+			GLMemoryRegistry::getInstance().removeAllocation(m_name, m_storageSize);
+		}
 		glDeleteBuffers(1, &m_handle);
 	}
 
@@ -34,10 +53,69 @@ public:
 		glBindBufferRange(target, index, m_handle, offset, size);
 	}
 
+	// the name the buffer is accounted under in the memory registry
+	void setName(const std::string& name)
+	{
+		if (m_storageSize > 0)
+		{
+			GLMemoryRegistry::getInstance().renameAllocation(m_name, name, m_storageSize);
+		}
+		m_name = name;
+	}
+
+	void recordUpload(GLsizeiptr size) const
+	{
+		GLMemoryRegistry::getInstance().addUpload(m_name, size);
+	}
+
 	GLuint getHandle() const { return m_handle; }
+	const std::string& getName() const { return m_name; }
+	GLsizeiptr getStorageSize() const { return m_storageSize; }
+
+protected:
+	void allocateStorage(GLsizeiptr size, const void* data, GLbitfield flags)
+	{
+		assert(m_storageSize == 0);
+		glNamedBufferStorage(m_handle, size, data, flags);
+		m_storageSize = size;
+		GLMemoryRegistry::getInstance().addAllocation(m_name, size);
+		if (data != nullptr)
+		{
+			recordUpload(size);
+		}
+	}
+
+	// mutable storage can be orphaned by specifying it again with glNamedBufferData
+	void allocateMutableStorage(GLsizeiptr size, const void* data, GLenum usage)
+	{
+		assert(m_storageSize == 0);
+		glNamedBufferData(m_handle, size, data, usage);
+		m_storageSize = size;
+		GLMemoryRegistry::getInstance().addAllocation(m_name, size);
+		if (data != nullptr)
+		{
+			recordUpload(size);
+		}
+	}
+
+	// immutable storage cannot be resized, a new buffer object takes the place of the current one
+	// and the caller deletes the returned previous handle once it does not need its content anymore
+	GLuint replaceHandle()
+	{
+		const GLuint previousHandle = m_handle;
+		glCreateBuffers(1, &m_handle);
+		if (m_storageSize > 0)
+		{
+			GLMemoryRegistry::getInstance().removeAllocation(m_name, m_storageSize);
+			m_storageSize = 0;
+		}
+		return previousHandle;
+	}
 
 protected:
 	GLuint m_handle;
+	std::string m_name;
+	GLsizeiptr m_storageSize;
 };
 
 class GLBuffer : public GLBufferBase
@@ -45,14 +123,14 @@ class GLBuffer : public GLBufferBase
 public:
 	GLBuffer() = default;
 
-	GLBuffer(const void* data, GLsizeiptr size)
+	GLBuffer(const void* data, GLsizeiptr size, GLbitfield flags = 0)
 	{
-		update(data, size);
+		update(data, size, flags);
 	}
 
-	void update(const void* data, GLsizeiptr size)
+	void update(const void* data, GLsizeiptr size, GLbitfield flags = 0)
 	{
-		glNamedBufferStorage(m_handle, size, data, 0);
+		allocateStorage(size, data, flags);
 	}
 };
 
@@ -69,77 +147,677 @@ class GLImmutableBuffer : public GLTypedBufferBase<T>
 public:
 	GLImmutableBuffer(const T& data)
 	{
-		glNamedBufferStorage(m_handle, getSize(), &data, 0);
+		allocateStorage(getSize(), &data, 0);
 	}
 };
 
-template <class T>
+// how GLMutableBuffer writes new data, drivers differ on which one is the fastest
+enum class GLUpdateStrategy
+{
+	// glNamedBufferSubData on a single copy of the data
+	SubData,
+	// full updates respecify the mutable storage so the driver can hand out fresh memory
+	Orphaning,
+	// NumFrames fenced slots in a persistently mapped coherent buffer
+	PersistentMapped,
+	// NumFrames fenced slots each written through glMapNamedBufferRange with GL_MAP_UNSYNCHRONIZED_BIT
+	UnsynchronizedMapRange
+};
+
+// compare the strategies with --benchmark-buffers before changing this on a platform
+constexpr GLUpdateStrategy PerFrameUpdateStrategy = GLUpdateStrategy::PersistentMapped;
+
+template <class T, GLUpdateStrategy Strategy = GLUpdateStrategy::SubData>
 class GLMutableBuffer : public GLTypedBufferBase<T>
 {
 public:
+	// number of slots used by the strategies that write each frame to a different copy of the data
+	static constexpr int NumFrames = 3;
+	static constexpr bool UsesSlots = Strategy == GLUpdateStrategy::PersistentMapped || Strategy == GLUpdateStrategy::UnsynchronizedMapRange;
+
 	GLMutableBuffer(const T* buffer = nullptr)
+		: m_mappedData(nullptr)
+		, m_slotSize(getSize())
+		, m_frameIndex(UsesSlots ? -1 : 0)
+		, m_stallTime(0.f)
 	{
-		glNamedBufferStorage(m_handle, getSize(), buffer, GL_DYNAMIC_STORAGE_BIT);
+		m_fences.fill(nullptr);
+
+		if constexpr (Strategy == GLUpdateStrategy::SubData)
+		{
+			allocateStorage(getSize(), buffer, GL_DYNAMIC_STORAGE_BIT);
+		}
+		else if constexpr (Strategy == GLUpdateStrategy::Orphaning)
+		{
+			allocateMutableStorage(getSize(), buffer, GL_STREAM_DRAW);
+		}
+		else
+		{
+			GLint uniformAlignment = 0;
+			GLint storageAlignment = 0;
+			glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniformAlignment);
+			glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &storageAlignment);
+			const GLsizeiptr alignment = std::max(uniformAlignment, storageAlignment);
+			m_slotSize = (getSize() + alignment - 1) / alignment * alignment;
+
+			if constexpr (Strategy == GLUpdateStrategy::PersistentMapped)
+			{
+				const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+				allocateStorage(m_slotSize * NumFrames, nullptr, flags);
+				m_mappedData = static_cast<std::uint8_t*>(glMapNamedBufferRange(m_handle, 0, m_slotSize * NumFrames, flags));
+				assert(m_mappedData != nullptr);
+			}
+			else
+			{
+				allocateStorage(m_slotSize * NumFrames, nullptr, GL_MAP_WRITE_BIT);
+			}
+
+			if (buffer != nullptr)
+			{
+				update(*buffer);
+			}
+		}
 	}
 
+	~GLMutableBuffer()
+	{
+		for (GLsync fence : m_fences)
+		{
+			if (fence != nullptr)
+			{
+				glDeleteSync(fence);
+			}
+		}
+		if (m_mappedData != nullptr)
+		{
+			glUnmapNamedBuffer(m_handle);
+		}
+	}
+
+	// with slots, every full update starts writing to the next slot
 	void update(const T& object)
 	{
+		if constexpr (UsesSlots)
+		{
+			// every command reading the current slot has been issued by now
+			if (m_frameIndex >= 0)
+			{
+				assert(m_fences[m_frameIndex] == nullptr);
+				m_fences[m_frameIndex] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			}
+
+			m_frameIndex = (m_frameIndex + 1) % NumFrames;
+			waitForSlot(m_frameIndex);
+		}
+		else if constexpr (Strategy == GLUpdateStrategy::Orphaning)
+		{
+			glNamedBufferData(m_handle, getSize(), &object, GL_STREAM_DRAW);
+			recordUpload(getSize());
+			return;
+		}
+
 		update(0, &object, getSize());
 	}
 
+	// with slots, partial updates write to the current slot
 	void update(GLintptr offset, const void* data, GLsizeiptr size)
 	{
 		assert(0 <= offset && offset < getSize());
 		assert(offset + size <= getSize());
-		glNamedBufferSubData(
-			m_handle,
-			offset,
-			size,
-			data
-		);
+		assert(m_frameIndex >= 0);
+
+		if constexpr (Strategy == GLUpdateStrategy::PersistentMapped)
+		{
+			std::memcpy(m_mappedData + getSlotOffset() + offset, data, size);
+		}
+		else if constexpr (Strategy == GLUpdateStrategy::UnsynchronizedMapRange)
+		{
+			const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT;
+			void* mappedData = glMapNamedBufferRange(m_handle, getSlotOffset() + offset, size, flags);
+			assert(mappedData != nullptr);
+			std::memcpy(mappedData, data, size);
+			glUnmapNamedBuffer(m_handle);
+		}
+		else
+		{
+			glNamedBufferSubData(
+				m_handle,
+				offset,
+				size,
+				data
+			);
+		}
+		recordUpload(size);
+	}
+
+	void bind(GLenum target, GLuint index)
+	{
+		if constexpr (UsesSlots)
+		{
+			assert(m_frameIndex >= 0);
+			bindRange(target, index, getSlotOffset(), getSize());
+		}
+		else
+		{
+			GLTypedBufferBase<T>::bind(target, index);
+		}
 	}
+
+	GLintptr getSlotOffset() const { return m_frameIndex * m_slotSize; }
+
+	// seconds spent blocked waiting for a slot the GPU was still reading
+	float getStallTime() const { return m_stallTime; }
+
+private:
+	void waitForSlot(int frameIndex)
+	{
+		GLsync& fence = m_fences[frameIndex];
+		if (fence == nullptr)
+		{
+			return;
+		}
+
+		GLenum result = glClientWaitSync(fence, 0, 0);
+		if (result == GL_TIMEOUT_EXPIRED)
+		{
+			using Clock = std::chrono::steady_clock;
+			const Clock::time_point startTime = Clock::now();
+			while (result == GL_TIMEOUT_EXPIRED)
+			{
+				result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+			}
+			m_stallTime += std::chrono::duration<float>(Clock::now() - startTime).count();
+		}
+		assert(result != GL_WAIT_FAILED);
+
+		glDeleteSync(fence);
+		fence = nullptr;
+	}
+
+private:
+	std::array<GLsync, NumFrames> m_fences;
+	std::uint8_t* m_mappedData;
+	GLsizeiptr m_slotSize;
+	int m_frameIndex;
+	float m_stallTime;
 };
 
-template <class T, int MaxElements>
-class GLArrayBuffer : public GLMutableBuffer<T[MaxElements]>
+// element ranges modified since the last upload
+class GLDirtyRanges
 {
 public:
-	GLArrayBuffer()
+	void add(size_t first, size_t count)
 	{
-		m_objects.reserve(getSize());
+		if (count == 0)
+		{
+			return;
+		}
+
+		// appending to the last range keeps sequential writes in a single range
+		if (!m_ranges.empty() && m_ranges.back().first <= first && first <= m_ranges.back().second)
+		{
+			m_ranges.back().second = std::max(m_ranges.back().second, first + count);
+		}
+		else
+		{
+			m_ranges.emplace_back(first, first + count);
+		}
+	}
+
+	// calls func(first, end) for each range, ranges less than mergeGap elements apart are merged
+	template <class Func>
+	void forEachMerged(size_t mergeGap, Func func)
+	{
+		if (m_ranges.empty())
+		{
+			return;
+		}
+
+		std::sort(m_ranges.begin(), m_ranges.end());
+
+		std::pair<size_t, size_t> range = m_ranges.front();
+		for (size_t i = 1; i < m_ranges.size(); ++i)
+		{
+			const std::pair<size_t, size_t>& nextRange = m_ranges[i];
+			if (nextRange.first <= range.second + mergeGap)
+			{
+				range.second = std::max(range.second, nextRange.second);
+			}
+			else
+			{
+				func(range.first, range.second);
+				range = nextRange;
+			}
+		}
+		func(range.first, range.second);
+	}
+
+	void clear() { m_ranges.clear(); }
+	bool isEmpty() const { return m_ranges.empty(); }
+
+private:
+	std::vector<std::pair<size_t, size_t>> m_ranges;
+};
+
+template <class T, int MaxElements, typename = std::enable_if_t<std::is_trivially_copyable_v<T>>>
+class GLArrayBuffer : public GLBufferBase
+{
+public:
+	static constexpr size_t DefaultInitialCapacity = 64;
+	// dirty ranges closer than this are uploaded together rather than in separate calls
+	static constexpr size_t DefaultMergeGap = 4096 / sizeof(T);
+
+	GLArrayBuffer(size_t initialCapacity = DefaultInitialCapacity)
+		: m_capacity(0)
+		, m_uploadedCount(0)
+		, m_residentCount(0)
+		, m_mergeGap(DefaultMergeGap)
+		, m_lastUploadBytes(0)
+		, m_lastUploadCalls(0)
+		, m_totalUploadBytes(0)
+	{
+		reserve(initialCapacity);
+	}
+
+	void reserve(size_t capacity)
+	{
+		assert(0 < capacity && capacity <= MaxElements);
+		m_objects.reserve(capacity);
+		if (capacity > m_capacity)
+		{
+			reallocate(capacity);
+		}
 	}
 
 	void clearObjects()
 	{
 		m_objects.clear();
+		m_dirtyRanges.clear();
+		m_uploadedCount = 0;
+		m_residentCount = 0;
 	}
 
 	void addObject(const T& object)
 	{
 		m_objects.emplace_back(object);
-		assert(static_cast<GLsizeiptr>(m_objects.size() * sizeof(T)) <= getSize());
+		assert(m_objects.size() <= MaxElements);
+		markDirty(m_objects.size() - 1, 1);
 	}
 
 	T& addObject()
 	{
 		T& object = m_objects.emplace_back();
-		assert(static_cast<GLsizeiptr>(m_objects.size() * sizeof(T)) <= getSize());
+		assert(m_objects.size() <= MaxElements);
+		markDirty(m_objects.size() - 1, 1);
 		return object;
 	}
 
+	// appends count default constructed objects and returns the first one, the range can be filled
+	// from several threads as long as the buffer itself is not modified meanwhile
+	T* addObjects(size_t count)
+	{
+		const size_t first = m_objects.size();
+		m_objects.resize(first + count);
+		assert(m_objects.size() <= MaxElements);
+		markDirty(first, count);
+		return m_objects.data() + first;
+	}
+
+	void setObject(size_t index, const T& object)
+	{
+		assert(index < m_objects.size());
+		m_objects[index] = object;
+		markDirty(index, 1);
+	}
+
+	const T& getObject(size_t index) const
+	{
+		assert(index < m_objects.size());
+		return m_objects[index];
+	}
+
+	T& editObject(size_t index)
+	{
+		assert(index < m_objects.size());
+		markDirty(index, 1);
+		return m_objects[index];
+	}
+
+	// the range can be filled from several threads like the one returned by addObjects()
+	T* editObjects(size_t first, size_t count)
+	{
+		markDirty(first, count);
+		return m_objects.data() + first;
+	}
+
+	void markDirty(size_t first, size_t count)
+	{
+		assert(first + count <= m_objects.size());
+		m_dirtyRanges.add(first, count);
+	}
+
 	void upload()
 	{
-		update(
-			0,
-			m_objects.data(),
-			m_objects.size() * sizeof(T)
-		);
+		m_lastUploadBytes = 0;
+		m_lastUploadCalls = 0;
+		uploadDirtyRanges([this](size_t first, size_t end)
+		{
+			uploadRange(first, end);
+		});
+		m_residentCount = m_objects.size();
+	}
+
+	// streams the dirty ranges through the queue, which copies them so that the objects can change right after
+	template <class UploadQueue>
+	void upload(UploadQueue& uploadQueue)
+	{
+		m_lastUploadBytes = 0;
+		m_lastUploadCalls = 0;
+		uploadDirtyRanges([this, &uploadQueue](size_t first, size_t end)
+		{
+			const GLsizeiptr size = static_cast<GLsizeiptr>((end - first) * sizeof(T));
+			uploadQueue.enqueueBuffer(*this, first * sizeof(T), m_objects.data() + first, size,
+				[this, first](GLsizeiptr residentBytes)
+				{
+					const size_t residentEnd = first + residentBytes / sizeof(T);
+					if (first <= m_residentCount && m_residentCount < residentEnd)
+					{
+						m_residentCount = residentEnd;
+					}
+				}
+			);
+			countUpload(size);
+		});
 	}
 
+	void setMergeGap(size_t mergeGap) { m_mergeGap = mergeGap; }
+
 	size_t getObjectCount() const { return m_objects.size(); }
 
+	// number of elements the GPU storage can hold, the CPU copy grows independently
+	size_t getCapacity() const { return m_capacity; }
+	GLsizeiptr getSize() const { return static_cast<GLsizeiptr>(m_capacity * sizeof(T)); }
+
+	// number of leading objects that have data on the GPU, lags behind getObjectCount() while streaming
+	size_t getResidentCount() const { return m_residentCount; }
+
+	GLsizeiptr getLastUploadBytes() const { return m_lastUploadBytes; }
+	int getLastUploadCalls() const { return m_lastUploadCalls; }
+	GLsizeiptr getTotalUploadBytes() const { return m_totalUploadBytes; }
+
+private:
+	template <class UploadRange>
+	void uploadDirtyRanges(UploadRange uploadRange)
+	{
+		if (m_objects.size() > m_capacity)
+		{
+			reallocate(getGrownCapacity(m_objects.size()));
+		}
+
+		m_dirtyRanges.forEachMerged(m_mergeGap, uploadRange);
+		m_dirtyRanges.clear();
+		m_uploadedCount = m_objects.size();
+	}
+
+	void uploadRange(size_t first, size_t end)
+	{
+		assert(first < end && end <= m_objects.size());
+		const GLsizeiptr size = static_cast<GLsizeiptr>((end - first) * sizeof(T));
+		glNamedBufferSubData(
+			m_handle,
+			first * sizeof(T),
+			size,
+			m_objects.data() + first
+		);
+		recordUpload(size);
+		countUpload(size);
+	}
+
+	void countUpload(GLsizeiptr size)
+	{
+		m_lastUploadBytes += size;
+		++m_lastUploadCalls;
+		m_totalUploadBytes += size;
+	}
+
+	size_t getGrownCapacity(size_t minCapacity) const
+	{
+		size_t capacity = std::max<size_t>(m_capacity, 1);
+		while (capacity < minCapacity)
+		{
+			capacity *= 2;
+		}
+		return std::min<size_t>(capacity, MaxElements);
+	}
+
+	void reallocate(size_t capacity)
+	{
+		// what was already uploaded is copied to the new storage on the GPU side
+		if (m_capacity > 0)
+		{
+			const GLuint previousHandle = replaceHandle();
+			allocateStorage(capacity * sizeof(T), nullptr, GL_DYNAMIC_STORAGE_BIT);
+			if (m_uploadedCount > 0)
+			{
+				glCopyNamedBufferSubData(previousHandle, m_handle, 0, 0, m_uploadedCount * sizeof(T));
+			}
+			glDeleteBuffers(1, &previousHandle);
+		}
+		else
+		{
+			allocateStorage(capacity * sizeof(T), nullptr, GL_DYNAMIC_STORAGE_BIT);
+		}
+		m_capacity = capacity;
+	}
+
 private:
 	std::vector<T> m_objects;
+	GLDirtyRanges m_dirtyRanges;
+	size_t m_capacity;
+	size_t m_uploadedCount;
+	size_t m_residentCount;
+	size_t m_mergeGap;
+
+	GLsizeiptr m_lastUploadBytes;
+	int m_lastUploadCalls;
+	GLsizeiptr m_totalUploadBytes;
+};
+
+// array buffer without a CPU copy: objects are written in place in a persistently mapped range of the
+// GPU buffer and upload() only flushes the ranges that were written to
+// growing the buffer maps a new range, which invalidates references to the objects
+// writes are not synchronized with the GPU, objects read by frames in flight should not be modified
+template <class T, int MaxElements, typename = std::enable_if_t<std::is_trivially_copyable_v<T>>>
+class GLMappedArrayBuffer : public GLBufferBase
+{
+public:
+	static constexpr size_t DefaultInitialCapacity = 64;
+	static constexpr size_t DefaultMergeGap = 4096 / sizeof(T);
+
+	GLMappedArrayBuffer(size_t initialCapacity = DefaultInitialCapacity)
+		: m_mappedObjects(nullptr)
+		, m_objectCount(0)
+		, m_capacity(0)
+		, m_residentCount(0)
+		, m_mergeGap(DefaultMergeGap)
+		, m_lastUploadBytes(0)
+		, m_lastUploadCalls(0)
+		, m_totalUploadBytes(0)
+	{
+		reserve(initialCapacity);
+	}
+
+	~GLMappedArrayBuffer()
+	{
+		glUnmapNamedBuffer(m_handle);
+	}
+
+	void reserve(size_t capacity)
+	{
+		assert(0 < capacity && capacity <= MaxElements);
+		if (capacity > m_capacity)
+		{
+			reallocate(capacity);
+		}
+	}
+
+	void clearObjects()
+	{
+		m_objectCount = 0;
+		m_dirtyRanges.clear();
+		m_residentCount = 0;
+	}
+
+	void addObject(const T& object)
+	{
+		addObject() = object;
+	}
+
+	T& addObject()
+	{
+		if (m_objectCount == m_capacity)
+		{
+			reallocate(getGrownCapacity(m_objectCount + 1));
+		}
+		T* object = new (m_mappedObjects + m_objectCount) T();
+		++m_objectCount;
+		markDirty(m_objectCount - 1, 1);
+		return *object;
+	}
+
+	// appends count objects and returns the first one, the range is write only like the objects returned by
+	// editObject() and can be filled from several threads as long as the buffer itself is not modified meanwhile
+	T* addObjects(size_t count)
+	{
+		if (m_objectCount + count > m_capacity)
+		{
+			reallocate(getGrownCapacity(m_objectCount + count));
+		}
+		T* objects = m_mappedObjects + m_objectCount;
+		m_objectCount += count;
+		assert(m_objectCount <= m_capacity);
+		markDirty(m_objectCount - count, count);
+		return objects;
+	}
+
+	void setObject(size_t index, const T& object)
+	{
+		editObject(index) = object;
+	}
+
+	// the mapping is write only, the returned object must not be read
+	T& editObject(size_t index)
+	{
+		assert(index < m_objectCount);
+		markDirty(index, 1);
+		return m_mappedObjects[index];
+	}
+
+	// write only like the range returned by addObjects()
+	T* editObjects(size_t first, size_t count)
+	{
+		markDirty(first, count);
+		return m_mappedObjects + first;
+	}
+
+	void markDirty(size_t first, size_t count)
+	{
+		assert(first + count <= m_objectCount);
+		m_dirtyRanges.add(first, count);
+	}
+
+	void upload()
+	{
+		m_lastUploadBytes = 0;
+		m_lastUploadCalls = 0;
+		flushDirtyRanges();
+		m_residentCount = m_objectCount;
+	}
+
+	// the objects already are in GPU memory, there is nothing to stream
+	template <class UploadQueue>
+	void upload(UploadQueue&)
+	{
+		upload();
+	}
+
+	void setMergeGap(size_t mergeGap) { m_mergeGap = mergeGap; }
+
+	size_t getObjectCount() const { return m_objectCount; }
+	size_t getCapacity() const { return m_capacity; }
+	GLsizeiptr getSize() const { return static_cast<GLsizeiptr>(m_capacity * sizeof(T)); }
+	size_t getResidentCount() const { return m_residentCount; }
+
+	// flushed bytes, nothing is copied
+	GLsizeiptr getLastUploadBytes() const { return m_lastUploadBytes; }
+	int getLastUploadCalls() const { return m_lastUploadCalls; }
+	GLsizeiptr getTotalUploadBytes() const { return m_totalUploadBytes; }
+
+private:
+	void flushDirtyRanges()
+	{
+		m_dirtyRanges.forEachMerged(m_mergeGap, [this](size_t first, size_t end)
+		{
+			const GLsizeiptr size = static_cast<GLsizeiptr>((end - first) * sizeof(T));
+			glFlushMappedNamedBufferRange(m_handle, first * sizeof(T), size);
+			recordUpload(size);
+			m_lastUploadBytes += size;
+			++m_lastUploadCalls;
+			m_totalUploadBytes += size;
+		});
+		m_dirtyRanges.clear();
+	}
+
+	size_t getGrownCapacity(size_t minCapacity) const
+	{
+		size_t capacity = std::max<size_t>(m_capacity, 1);
+		while (capacity < minCapacity)
+		{
+			capacity *= 2;
+		}
+		return std::min<size_t>(capacity, MaxElements);
+	}
+
+	void reallocate(size_t capacity)
+	{
+		const GLbitfield storageFlags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT;
+		const GLbitfield mapFlags = storageFlags | GL_MAP_FLUSH_EXPLICIT_BIT;
+
+		if (m_capacity > 0)
+		{
+			// pending writes have to reach the current storage before it is copied
+			flushDirtyRanges();
+			glUnmapNamedBuffer(m_handle);
+
+			const GLuint previousHandle = replaceHandle();
+			allocateStorage(capacity * sizeof(T), nullptr, storageFlags);
+			if (m_objectCount > 0)
+			{
+				glCopyNamedBufferSubData(previousHandle, m_handle, 0, 0, m_objectCount * sizeof(T));
+			}
+			glDeleteBuffers(1, &previousHandle);
+		}
+		else
+		{
+			allocateStorage(capacity * sizeof(T), nullptr, storageFlags);
+		}
+
+		m_mappedObjects = static_cast<T*>(glMapNamedBufferRange(m_handle, 0, capacity * sizeof(T), mapFlags));
+		assert(m_mappedObjects != nullptr);
+		m_capacity = capacity;
+	}
+
+private:
+	T* m_mappedObjects;
+	GLDirtyRanges m_dirtyRanges;
+	size_t m_objectCount;
+	size_t m_capacity;
+	size_t m_residentCount;
+	size_t m_mergeGap;
+
+	GLsizeiptr m_lastUploadBytes;
+	int m_lastUploadCalls;
+	GLsizeiptr m_totalUploadBytes;
 };
 
 template <int MaxElements>
@@ -167,9 +845,110 @@ public:
 		command.baseInstance = baseInstance;
 	}
 
+	// draws one more instance, extending the last command when it draws the same geometry up to the previous instance
+	void addInstance(
+		GLuint count,
+		GLuint firstIndex,
+		GLuint baseVertex,
+		GLuint instanceIndex,
+		GLuint maxInstancesPerCommand
+	)
+	{
+		const size_t commandCount = getObjectCount();
+		if (commandCount > 0)
+		{
+			DrawElementsIndirectCommand command = getObject(commandCount - 1);
+			if (command.count == count
+				&& command.firstIndex == firstIndex
+				&& command.baseVertex == baseVertex
+				&& command.baseInstance + command.instanceCount == instanceIndex
+				&& command.instanceCount < maxInstancesPerCommand)
+			{
+				++command.instanceCount;
+				setObject(commandCount - 1, command);
+				return;
+			}
+		}
+		addCommand(count, 1, firstIndex, baseVertex, instanceIndex);
+	}
+
+	// draws instanceCount more instances from firstInstanceIndex, filling the last command first when it draws
+	// the same geometry up to the first instance, then adding commands of at most maxInstancesPerCommand
+	void addInstances(
+		GLuint count,
+		GLuint firstIndex,
+		GLuint baseVertex,
+		GLuint firstInstanceIndex,
+		GLuint instanceCount,
+		GLuint maxInstancesPerCommand
+	)
+	{
+		const size_t commandCount = getObjectCount();
+		if (commandCount > 0 && instanceCount > 0)
+		{
+			DrawElementsIndirectCommand command = getObject(commandCount - 1);
+			if (command.count == count
+				&& command.firstIndex == firstIndex
+				&& command.baseVertex == baseVertex
+				&& command.baseInstance + command.instanceCount == firstInstanceIndex
+				&& command.instanceCount < maxInstancesPerCommand)
+			{
+				const GLuint room = std::min(instanceCount, maxInstancesPerCommand - command.instanceCount);
+				command.instanceCount += room;
+				setObject(commandCount - 1, command);
+				firstInstanceIndex += room;
+				instanceCount -= room;
+			}
+		}
+		while (instanceCount > 0)
+		{
+			const GLuint commandInstanceCount = std::min(instanceCount, maxInstancesPerCommand);
+			addCommand(count, commandInstanceCount, firstIndex, baseVertex, firstInstanceIndex);
+			firstInstanceIndex += commandInstanceCount;
+			instanceCount -= commandInstanceCount;
+		}
+	}
+
 	void draw()
 	{
+		draw(static_cast<GLsizei>(getObjectCount()));
+	}
+
+	void draw(GLsizei drawCount)
+	{
+		assert(0 <= drawCount && drawCount <= static_cast<GLsizei>(getObjectCount()));
 		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_handle);
-		glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, nullptr, static_cast<GLsizei>(getObjectCount()), 0);
+		glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, nullptr, drawCount, 0);
+	}
+
+	// the number of commands to draw is read by the GPU from a GLuint in parameterBuffer at parameterOffset
+	// so that a compute pass can write both the commands and their count without any CPU readback
+	// the bundled GLEW predates GL 4.6 and only exposes the ARB_indirect_parameters entry point of the same function
+	void drawIndirectCount(const GLBufferBase& parameterBuffer, GLintptr parameterOffset, GLsizei maxDrawCount)
+	{
+		drawIndirectCount(*this, 0, parameterBuffer, parameterOffset, maxDrawCount);
+	}
+
+	static void drawIndirectCount(
+		const GLBufferBase& commandsBuffer,
+		GLintptr commandsOffset,
+		const GLBufferBase& parameterBuffer,
+		GLintptr parameterOffset,
+		GLsizei maxDrawCount
+	)
+	{
+		assert(commandsOffset % sizeof(GLuint) == 0);
+		assert(parameterOffset % sizeof(GLuint) == 0);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandsBuffer.getHandle());
+		glBindBuffer(GL_PARAMETER_BUFFER_ARB, parameterBuffer.getHandle());
+		glMultiDrawElementsIndirectCountARB(
+			GL_TRIANGLES,
+			GL_UNSIGNED_INT,
+			reinterpret_cast<const void*>(commandsOffset),
+			parameterOffset,
+			maxDrawCount,
+			0
+		);
+		glBindBuffer(GL_PARAMETER_BUFFER_ARB, 0);
 	}
 };
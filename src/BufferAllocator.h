@@ -0,0 +1,304 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+#include <GL/glew.h>
+
+#include "Buffer.h"
+
+// a range of one of the backing buffers owned by a GLBufferAllocator
+struct GLBufferSlice
+{
+	GLBufferBase* buffer = nullptr;
+	GLintptr offset = 0;
+	GLsizeiptr size = 0;
+
+	int pageIndex = -1;
+	int order = -1;
+
+	bool isValid() const { return buffer != nullptr; }
+
+	void bind(GLenum target, GLuint index) const
+	{
+		assert(isValid());
+		buffer->bindRange(target, index, offset, size);
+	}
+
+	void update(GLintptr localOffset, const void* data, GLsizeiptr dataSize) const
+	{
+		assert(isValid());
+		assert(0 <= localOffset && localOffset + dataSize <= size);
+		glNamedBufferSubData(buffer->getHandle(), offset + localOffset, dataSize, data);
+		buffer->recordUpload(dataSize);
+	}
+};
+
+// buddy allocator carving slices out of a few large buffers instead of creating one buffer object each
+class GLBufferAllocator
+{
+public:
+	static constexpr GLsizeiptr MinBlockSize = 256;
+	static constexpr GLsizeiptr DefaultPageSize = 16 * 1024 * 1024;
+
+	// the backing buffers are accounted under name in the memory registry
+	GLBufferAllocator(const std::string& name, GLsizeiptr pageSize = DefaultPageSize)
+		: m_name(name)
+		, m_pageSize(getBlockSize(getOrder(pageSize)))
+		, m_allocatedBytes(0)
+	{
+		GLint uniformAlignment = 0;
+		GLint storageAlignment = 0;
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniformAlignment);
+		glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &storageAlignment);
+		m_uniformAlignment = uniformAlignment;
+		m_storageAlignment = storageAlignment;
+	}
+
+	GLBufferAllocator(const GLBufferAllocator&) = delete;
+	void operator=(const GLBufferAllocator&) = delete;
+
+	// target is the binding point the slice will be used with, it decides the offset alignment
+	GLBufferSlice allocate(GLsizeiptr size, GLenum target)
+	{
+		assert(size > 0);
+		const GLsizeiptr alignment = getAlignment(target);
+		const int order = getOrder(std::max(size, alignment));
+
+		GLBufferSlice slice;
+		for (int pageIndex = 0; pageIndex < static_cast<int>(m_pages.size()); ++pageIndex)
+		{
+			if (m_pages[pageIndex] != nullptr && allocateFromPage(pageIndex, order, slice))
+			{
+				break;
+			}
+		}
+
+		if (!slice.isValid())
+		{
+			const int pageIndex = addPage(std::max(order, getOrder(m_pageSize)));
+			const bool allocated = allocateFromPage(pageIndex, order, slice);
+			assert(allocated);
+		}
+
+		assert(slice.offset % alignment == 0);
+		slice.size = size;
+		m_allocatedBytes += getBlockSize(slice.order);
+		return slice;
+	}
+
+	void release(GLBufferSlice& slice)
+	{
+		assert(slice.isValid());
+		Page& page = *m_pages[slice.pageIndex];
+
+		// merge the block with its buddy as long as the buddy is free too
+		GLintptr offset = slice.offset;
+		int order = slice.order;
+		while (order < page.maxOrder)
+		{
+			const GLintptr buddyOffset = offset ^ getBlockSize(order);
+			std::set<GLintptr>& freeBlocks = page.freeBlocks[order];
+			std::set<GLintptr>::iterator buddy = freeBlocks.find(buddyOffset);
+			if (buddy == freeBlocks.end())
+			{
+				break;
+			}
+			freeBlocks.erase(buddy);
+			offset = std::min(offset, buddyOffset);
+			++order;
+		}
+		page.freeBlocks[order].insert(offset);
+
+		m_allocatedBytes -= getBlockSize(slice.order);
+		page.allocatedBytes -= getBlockSize(slice.order);
+		slice = GLBufferSlice();
+	}
+
+	// deletes backing buffers that have no live slice left
+	void trim()
+	{
+		for (std::unique_ptr<Page>& page : m_pages)
+		{
+			if (page != nullptr && page->allocatedBytes == 0)
+			{
+				page.reset();
+			}
+		}
+	}
+
+	GLsizeiptr getAlignment(GLenum target) const
+	{
+		switch (target)
+		{
+		case GL_UNIFORM_BUFFER: return m_uniformAlignment;
+		case GL_SHADER_STORAGE_BUFFER: return m_storageAlignment;
+		case GL_DRAW_INDIRECT_BUFFER: return sizeof(GLuint);
+		case GL_DISPATCH_INDIRECT_BUFFER: return sizeof(GLuint);
+		}
+		return MinBlockSize;
+	}
+
+	GLsizeiptr getAllocatedBytes() const { return m_allocatedBytes; }
+
+	GLsizeiptr getReservedBytes() const
+	{
+		GLsizeiptr reservedBytes = 0;
+		for (const std::unique_ptr<Page>& page : m_pages)
+		{
+			if (page != nullptr)
+			{
+				reservedBytes += getBlockSize(page->maxOrder);
+			}
+		}
+		return reservedBytes;
+	}
+
+protected:
+	struct Page
+	{
+		GLBuffer buffer;
+		std::vector<std::set<GLintptr>> freeBlocks;
+		GLsizeiptr allocatedBytes = 0;
+		int maxOrder = 0;
+	};
+
+	static GLsizeiptr getBlockSize(int order)
+	{
+		return MinBlockSize << order;
+	}
+
+	static int getOrder(GLsizeiptr size)
+	{
+		int order = 0;
+		while (getBlockSize(order) < size)
+		{
+			++order;
+		}
+		return order;
+	}
+
+	int addPage(int maxOrder)
+	{
+		std::unique_ptr<Page> page = std::make_unique<Page>();
+		page->buffer.setName(m_name);
+		page->buffer.update(nullptr, getBlockSize(maxOrder), GL_DYNAMIC_STORAGE_BIT);
+		page->freeBlocks.resize(maxOrder + 1);
+		page->freeBlocks[maxOrder].insert(0);
+		page->maxOrder = maxOrder;
+
+		for (int pageIndex = 0; pageIndex < static_cast<int>(m_pages.size()); ++pageIndex)
+		{
+			if (m_pages[pageIndex] == nullptr)
+			{
+				m_pages[pageIndex] = std::move(page);
+				return pageIndex;
+			}
+		}
+		m_pages.push_back(std::move(page));
+		return static_cast<int>(m_pages.size()) - 1;
+	}
+
+	bool allocateFromPage(int pageIndex, int order, GLBufferSlice& slice)
+	{
+		Page& page = *m_pages[pageIndex];
+
+		int freeOrder = order;
+		while (freeOrder <= page.maxOrder && page.freeBlocks[freeOrder].empty())
+		{
+			++freeOrder;
+		}
+		if (freeOrder > page.maxOrder)
+		{
+			return false;
+		}
+
+		const GLintptr offset = *page.freeBlocks[freeOrder].begin();
+		page.freeBlocks[freeOrder].erase(page.freeBlocks[freeOrder].begin());
+
+		// split the block until it has the requested size, the upper halves become free
+		while (freeOrder > order)
+		{
+			--freeOrder;
+			page.freeBlocks[freeOrder].insert(offset + getBlockSize(freeOrder));
+		}
+
+		page.allocatedBytes += getBlockSize(order);
+
+		slice.buffer = &page.buffer;
+		slice.offset = offset;
+		slice.pageIndex = pageIndex;
+		slice.order = order;
+		return true;
+	}
+
+protected:
+	std::string m_name;
+	std::vector<std::unique_ptr<Page>> m_pages;
+	GLsizeiptr m_pageSize;
+	GLsizeiptr m_allocatedBytes;
+	GLsizeiptr m_uniformAlignment;
+	GLsizeiptr m_storageAlignment;
+};
+
+// storage only written and read by the GPU carved out of an allocator, its content is lost when it grows,
+// the allocator must outlive the slice
+class GLDeviceSlice
+{
+public:
+	GLDeviceSlice(GLBufferAllocator& allocator, GLenum target)
+		: m_allocator(allocator)
+		, m_target(target)
+	{
+
+	}
+
+	GLDeviceSlice(const GLDeviceSlice&) = delete;
+	void operator=(const GLDeviceSlice&) = delete;
+
+	~GLDeviceSlice()
+	{
+		if (m_slice.isValid())
+		{
+			m_allocator.release(m_slice);
+		}
+	}
+
+	void reserve(GLsizeiptr size)
+	{
+		if (size <= m_slice.size)
+		{
+			return;
+		}
+
+		size = std::max(size, m_slice.size * 2);
+		if (m_slice.isValid())
+		{
+			m_allocator.release(m_slice);
+		}
+		m_slice = m_allocator.allocate(size, m_target);
+	}
+
+	void bind(GLenum target, GLuint index) const
+	{
+		m_slice.bind(target, index);
+	}
+
+	const GLBufferBase& getBuffer() const
+	{
+		assert(m_slice.isValid());
+		return *m_slice.buffer;
+	}
+
+	GLuint getHandle() const { return getBuffer().getHandle(); }
+	GLintptr getOffset() const { return m_slice.offset; }
+	GLsizeiptr getSize() const { return m_slice.size; }
+
+protected:
+	GLBufferAllocator& m_allocator;
+	GLenum m_target;
+	GLBufferSlice m_slice;
+};
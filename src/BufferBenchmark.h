@@ -0,0 +1,83 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <GL/glew.h>
+
+#include "Buffer.h"
+#include "TileMesh.h"
+
+// measures every GLMutableBuffer update strategy on small per-frame blocks and on 1 MB blocks
+// each frame the GPU reads the buffer back like a draw call would, so that updates may have to wait for it
+class BufferBenchmark
+{
+public:
+	static constexpr int NumFrames = 1000;
+
+	struct MegabyteData
+	{
+		std::uint8_t bytes[1024 * 1024];
+	};
+
+	static void run(std::ostream& out)
+	{
+		out << "strategy,size,updateMs,maxUpdateMs,stallMs,frameMs" << std::endl;
+		runSize<TileMesh::PerFrameData>(out);
+		runSize<MegabyteData>(out);
+	}
+
+protected:
+	template <class T>
+	static void runSize(std::ostream& out)
+	{
+		runStrategy<T, GLUpdateStrategy::SubData>(out, "SubData");
+		runStrategy<T, GLUpdateStrategy::Orphaning>(out, "Orphaning");
+		runStrategy<T, GLUpdateStrategy::PersistentMapped>(out, "PersistentMapped");
+		runStrategy<T, GLUpdateStrategy::UnsynchronizedMapRange>(out, "UnsynchronizedMapRange");
+	}
+
+	template <class T, GLUpdateStrategy Strategy>
+	static void runStrategy(std::ostream& out, const char* strategyName)
+	{
+		using Clock = std::chrono::steady_clock;
+		using Milliseconds = std::chrono::duration<double, std::milli>;
+
+		GLMutableBuffer<T, Strategy> buffer;
+		buffer.setName("BufferBenchmark.buffer");
+		GLBuffer readBuffer(nullptr, sizeof(T));
+		readBuffer.setName("BufferBenchmark.readBuffer");
+		std::unique_ptr<T> data = std::make_unique<T>();
+		std::uint8_t* bytes = reinterpret_cast<std::uint8_t*>(data.get());
+
+		glFinish();
+
+		double updateTime = 0.0;
+		double maxUpdateTime = 0.0;
+		const Clock::time_point startTime = Clock::now();
+		for (int frame = 0; frame < NumFrames; ++frame)
+		{
+			bytes[frame % sizeof(T)] = static_cast<std::uint8_t>(frame);
+
+			const Clock::time_point updateStartTime = Clock::now();
+			buffer.update(*data);
+			const double frameUpdateTime = Milliseconds(Clock::now() - updateStartTime).count();
+			updateTime += frameUpdateTime;
+			maxUpdateTime = std::max(maxUpdateTime, frameUpdateTime);
+
+			glCopyNamedBufferSubData(buffer.getHandle(), readBuffer.getHandle(), buffer.getSlotOffset(), 0, sizeof(T));
+			glFlush();
+		}
+		glFinish();
+		const double totalTime = Milliseconds(Clock::now() - startTime).count();
+
+		out << strategyName << ','
+			<< sizeof(T) << ','
+			<< updateTime / NumFrames << ','
+			<< maxUpdateTime << ','
+			<< buffer.getStallTime() * 1000.0 << ','
+			<< totalTime / NumFrames << std::endl;
+	}
+};
@@ -9,6 +9,7 @@ class Camera
 public:
 	Camera()
 		: m_center(0.f)
+		, m_rotation(0.f)
 	{
 		m_view = glm::mat4(
 			glm::vec4(axes[0], 0.f),
@@ -35,12 +36,16 @@ public:
 		m_view = glm::translate(m_view, m_center);
 		m_view = glm::rotate(m_view, angle, glm::vec3(0.f, 0.f, 1.f));
 		m_view = glm::translate(m_view, -m_center);
+		m_rotation += angle;
 	}
 
 	const glm::mat4& getViewMatrix() const { return m_view; }
 	const glm::vec3& getCenter() const { return m_center; }
+	// sum of the angles passed to rotate(), around the z axis
+	float getRotation() const { return m_rotation; }
 
 protected:
 	glm::mat4 m_view;
 	glm::vec3 m_center;
+	float m_rotation;
 };
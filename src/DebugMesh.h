@@ -28,6 +28,9 @@ public:
 
 	DebugMesh()
 	{
+		m_perFrameDataBuffer.setName("DebugMesh.perFrameData");
+		m_verticesBuffer.setName("DebugMesh.vertices");
+
 		glCreateVertexArrays(1, &m_vao);
 		glVertexArrayVertexBuffer(m_vao, 0, m_verticesBuffer.getHandle(), 0, sizeof(Vertex));
 		// position
@@ -73,6 +76,8 @@ public:
 	void draw()
 	{
 		m_verticesBuffer.upload();
+		// the vertex buffer object is replaced whenever it grows
+		glVertexArrayVertexBuffer(m_vao, 0, m_verticesBuffer.getHandle(), 0, sizeof(Vertex));
 
 		m_debugProgram.use();
 
@@ -89,7 +94,7 @@ public:
 protected:
 	static constexpr GLuint PerFrameBufferIndex = 0;
 
-	GLMutableBuffer<PerFrameData> m_perFrameDataBuffer;
+	GLMutableBuffer<PerFrameData, PerFrameUpdateStrategy> m_perFrameDataBuffer;
 
 	GLuint m_vao;
 	GLArrayBuffer<Vertex, MaxVertices> m_verticesBuffer;
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <string>
+#include <GL/glew.h>
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+#include "MemoryRegistry.h"
+#include "Program.h"
+
+// mip chain of the farthest depth of the depth buffer, every texel of a level holds the maximum of the texels it covers
+// in the level below, so that a box whose nearest depth is beyond a single texel fetch is hidden from the whole area
+class DepthPyramid
+{
+public:
+	DepthPyramid(const DepthPyramid&) = delete;
+	DepthPyramid(DepthPyramid&&) = delete;
+	void operator=(const DepthPyramid&) = delete;
+	void operator=(DepthPyramid&&) = delete;
+
+	DepthPyramid(const std::string& name)
+		: m_name(name)
+		, m_depthTexture(0)
+		, m_pyramidTexture(0)
+		, m_size(0)
+		, m_levelCount(0)
+		, m_valid(false)
+	{
+		m_buildProgram.loadCompute("shaders/depthpyramid.comp");
+	}
+
+	~DepthPyramid()
+	{
+		destroyTextures();
+	}
+
+	// copies the depth buffer of the bound read framebuffer over the given size and rebuilds all the levels
+	void update(const glm::ivec2& size)
+	{
+		assert(size.x > 0 && size.y > 0);
+		if (size != m_size)
+		{
+			destroyTextures();
+			createTextures(size);
+		}
+
+		glCopyTextureSubImage2D(m_depthTexture, 0, 0, 0, 0, 0, m_size.x, m_size.y);
+
+		m_buildProgram.use();
+		glBindTextureUnit(DepthTextureUnit, m_depthTexture);
+		glm::ivec2 levelSize = m_size;
+		for (GLint level = 0; level < m_levelCount; ++level)
+		{
+			// the first level is a copy of the depth texture, the others reduce the level below
+			glProgramUniform1i(m_buildProgram.getProgramId(), LevelUniformLocation, level);
+			glBindImageTexture(SourceImageUnit, m_pyramidTexture, std::max(level - 1, 0), GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+			glBindImageTexture(DestinationImageUnit, m_pyramidTexture, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+			glDispatchCompute((levelSize.x + GroupSize - 1) / GroupSize, (levelSize.y + GroupSize - 1) / GroupSize, 1);
+			glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+			levelSize = glm::max(levelSize / 2, glm::ivec2(1));
+		}
+		glUseProgram(0);
+
+		m_valid = true;
+	}
+
+	// the pyramid keeps the depth of the last update until the next one
+	void invalidate()
+	{
+		m_valid = false;
+	}
+
+	bool isValid() const { return m_valid; }
+	GLuint getTexture() const { return m_pyramidTexture; }
+	const glm::ivec2& getSize() const { return m_size; }
+	GLint getLevelCount() const { return m_levelCount; }
+
+protected:
+	void createTextures(const glm::ivec2& size)
+	{
+		m_size = size;
+		m_levelCount = 1;
+		while ((std::max(m_size.x, m_size.y) >> m_levelCount) > 0)
+		{
+			++m_levelCount;
+		}
+
+		glCreateTextures(GL_TEXTURE_2D, 1, &m_depthTexture);
+		glTextureParameteri(m_depthTexture, GL_TEXTURE_MAX_LEVEL, 0);
+		glTextureParameteri(m_depthTexture, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTextureParameteri(m_depthTexture, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTextureStorage2D(m_depthTexture, 1, GL_DEPTH_COMPONENT32F, m_size.x, m_size.y);
+
+		glCreateTextures(GL_TEXTURE_2D, 1, &m_pyramidTexture);
+		glTextureParameteri(m_pyramidTexture, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+		glTextureParameteri(m_pyramidTexture, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTextureStorage2D(m_pyramidTexture, m_levelCount, GL_R32F, m_size.x, m_size.y);
+
+		GLMemoryRegistry::getInstance().addAllocation(m_name, getStorageSize());
+	}
+
+	void destroyTextures()
+	{
+		if (m_levelCount == 0)
+		{
+			return;
+		}
+		glDeleteTextures(1, &m_depthTexture);
+		glDeleteTextures(1, &m_pyramidTexture);
+		GLMemoryRegistry::getInstance().removeAllocation(m_name, getStorageSize());
+		m_depthTexture = 0;
+		m_pyramidTexture = 0;
+		m_size = glm::ivec2(0);
+		m_levelCount = 0;
+		m_valid = false;
+	}
+
+	// the depth copy followed by every level of the pyramid
+	GLsizeiptr getStorageSize() const
+	{
+		GLsizeiptr storageSize = static_cast<GLsizeiptr>(m_size.x) * m_size.y * 4;
+		glm::ivec2 levelSize = m_size;
+		for (GLint level = 0; level < m_levelCount; ++level)
+		{
+			storageSize += static_cast<GLsizeiptr>(levelSize.x) * levelSize.y * 4;
+			levelSize = glm::max(levelSize / 2, glm::ivec2(1));
+		}
+		return storageSize;
+	}
+
+protected:
+	static constexpr GLuint DepthTextureUnit = 0;
+	static constexpr GLuint SourceImageUnit = 0;
+	static constexpr GLuint DestinationImageUnit = 1;
+	static constexpr GLint LevelUniformLocation = 0;
+	// local size of the build compute shader in both dimensions
+	static constexpr GLint GroupSize = 8;
+
+	std::string m_name;
+	GLuint m_depthTexture;
+	GLuint m_pyramidTexture;
+	glm::ivec2 m_size;
+	GLint m_levelCount;
+	bool m_valid;
+
+	GLProgram m_buildProgram;
+};
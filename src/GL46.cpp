@@ -1,5 +1,7 @@
 #include <cassert>
 #include <iostream>
+#include <memory>
+#include <string>
 #include <SDL2/SDL.h>
 #include <GL/glew.h>
 
@@ -7,10 +9,16 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtx/rotate_vector.hpp>
 
+#include "BufferBenchmark.h"
 #include "Camera.h"
 #include "DebugMesh.h"
+#include "LoaderThread.h"
+#include "MemoryRegistry.h"
+#include "TileChunk.h"
 #include "TileMesh.h"
+#include "TileStreamer.h"
 #include "TileTemplate.h"
+#include "UploadQueue.h"
 
 #define DEFAULT_WINDOW_WIDTH 500
 #define DEFAULT_WINDOW_HEIGHT 500
@@ -60,9 +68,17 @@ int main(int argc, char* argv[])
 	glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
 	glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DEBUG_SEVERITY_NOTIFICATION, 0, nullptr, GL_FALSE);
 
+	if (argc > 1 && std::string(argv[1]) == "--benchmark-buffers")
+	{
+		BufferBenchmark::run(std::cout);
+		SDL_DestroyWindow(window);
+		SDL_Quit();
+		return 0;
+	}
+
 	glClearColor(0.5f, 0.3f, 0.2f, 1.f);
 
-	glEnable(GL_BLEND);
+	// blending is only enabled by the passes that need it
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
 	glEnable(GL_DEPTH_TEST);
@@ -83,29 +99,63 @@ int main(int argc, char* argv[])
 		70.f,
 		70.f
 	};
-	TileTemplate tileTemplate(
-		"data/grass.png",
-		probabilities, sizeof(probabilities) / sizeof(float),
-		0.15f,
-		4
-	);
-
-	TileMesh tileMesh(tileTemplate);
-
-	int tileTemplateIndex = tileMesh.addTileTemplate(tileTemplate);
 
-	constexpr int mapHalfSize = 200;
-	for (int x = -mapHalfSize; x <= mapHalfSize; ++x)
-	{
-		const float fx = static_cast<float>(x);
-		for (int y = -mapHalfSize; y <= mapHalfSize; ++y)
+	// the tileset is decoded on the loader thread while the render loop is already running, then its pixels
+	// are streamed in by the queue over the frames along with the commands of the chunks around the camera
+	GLUploadQueue uploadQueue;
+	SDL_Surface* tilesetImage = nullptr;
+	std::unique_ptr<TileTemplate> tileTemplate;
+	std::unique_ptr<TileMesh> tileMesh;
+	std::unique_ptr<TileChunkMap> tileChunkMap;
+	std::unique_ptr<TileStreamer> tileStreamer;
+
+	GLLoaderThread loaderThread(window, glContext);
+	loaderThread.post(
+		[&tilesetImage]()
+		{
+			tilesetImage = IMG_Load("data/grass.png");
+			assert(tilesetImage != nullptr);
+		},
+		[&tilesetImage, &tileTemplate, &tileMesh, &tileChunkMap, &tileStreamer, &uploadQueue]()
 		{
-			const float fy = static_cast<float>(y);
-			const float z = std::cos(std::sqrt(fx * fx + fy * fy) * 0.5f) * 0.8f - std::min(std::max(std::abs(fx), std::abs(fy)), 10.f) * 0.8f;
-			tileMesh.addTile(glm::vec3(x, y, z), tileTemplateIndex);
+			tileTemplate = std::make_unique<TileTemplate>(
+				std::make_shared<BindlessTexture>("data/grass.png", *tilesetImage, uploadQueue),
+				probabilities, sizeof(probabilities) / sizeof(float),
+				0.15f,
+				4
+			);
+			SDL_FreeSurface(tilesetImage);
+			tilesetImage = nullptr;
+			tileMesh = std::make_unique<TileMesh>();
+			// zoomed out, flat areas are drawn with merged tile tops
+			tileMesh->setMergeTopsMaxZoom(0.25f);
+
+			const int tileTemplateIndex = tileMesh->addTileTemplate(*tileTemplate);
+
+			// one tile per cell over 10000x10000 cells, far more than the mesh holds at once
+			constexpr int worldHalfSize = 5000;
+			tileChunkMap = std::make_unique<TileChunkMap>(*tileMesh);
+			tileChunkMap->setUploadQueue(&uploadQueue);
+			tileStreamer = std::make_unique<TileStreamer>(*tileChunkMap, [tileTemplateIndex](const glm::ivec2& coords, std::vector<TileMesh::TilePlacement>& tiles)
+			{
+				const glm::ivec2 firstCell = coords * TileChunk::Size;
+				for (int y = firstCell.y; y < firstCell.y + TileChunk::Size; ++y)
+				{
+					for (int x = firstCell.x; x < firstCell.x + TileChunk::Size; ++x)
+					{
+						if (std::abs(x) > worldHalfSize || std::abs(y) > worldHalfSize)
+						{
+							continue;
+						}
+						const float fx = static_cast<float>(x);
+						const float fy = static_cast<float>(y);
+						const float z = std::round((std::sin(fx * 0.05f) + std::cos(fy * 0.07f)) * 2.f) * 0.4f;
+						tiles.push_back({ glm::vec3(fx, fy, z), tileTemplateIndex });
+					}
+				}
+			});
 		}
-	}
-	tileMesh.upload();
+	);
 
 	// debug
 	DebugMesh debugMesh;
@@ -133,6 +183,12 @@ int main(int argc, char* argv[])
 				case SDLK_ESCAPE:
 					loop = false;
 					break;
+				case SDLK_F1:
+					GLMemoryRegistry::getInstance().dumpCsv(std::cout);
+					break;
+				case SDLK_F2:
+					GLMemoryRegistry::getInstance().dumpJson(std::cout);
+					break;
 				}
 				break;
 			case SDL_MOUSEWHEEL:
@@ -201,6 +257,9 @@ int main(int argc, char* argv[])
 			camera.rotate(rotation * dt);
 		}
 
+		loaderThread.poll();
+		uploadQueue.process();
+
 		glViewport(0, 0, windowWidth, windowHeight);
 
 		glClear(GL_COLOR_BUFFER_BIT);
@@ -215,7 +274,11 @@ int main(int argc, char* argv[])
 		const glm::vec3 initialLightDirection = glm::normalize(glm::vec3(-1.f, -1.f, -1.f));
 		const glm::vec3 lightDirection = glm::rotateZ(initialLightDirection, t1);
 
+		if (tileMesh != nullptr)
 		{
+			// only places the chunks generated already
+			tileStreamer->update(camera, projection * view);
+
 			TileMesh::PerFrameData perFrameData;
 			perFrameData.view = view;
 			perFrameData.projection = projection;
@@ -223,9 +286,10 @@ int main(int argc, char* argv[])
 			perFrameData.dirtColor = glm::vec4(0.51f, 0.43f, 0.3f, 1.f);
 
 			perFrameData.lightDirection = glm::vec4(lightDirection, 1.f);
-			tileMesh.setPerFrameData(perFrameData);
+			tileMesh->setPerFrameData(perFrameData);
+			tileMesh->setViewRotation(camera.getRotation());
 
-			tileMesh.draw();
+			tileMesh->draw();
 		}
 
 		{
@@ -249,15 +313,23 @@ int main(int argc, char* argv[])
 
         SDL_GL_SwapWindow(window);
 
+		GLMemoryRegistry::getInstance().endFrame();
+
 		const float t2 = static_cast<float>(SDL_GetTicks()) * 0.001f;
 		dt = t2 - t1;
 		const float fps = 1.f / dt;
 
 		std::stringstream title;
-		title << fps;
+		title << fps << " fps, " << GLMemoryRegistry::getInstance().getLiveBytes() / (1024 * 1024) << " MB";
+		if (tileChunkMap != nullptr)
+		{
+			title << ", " << tileChunkMap->getLoadedChunkCount() << " chunks, " << tileChunkMap->getLoadedTileCount() << " tiles";
+		}
 		SDL_SetWindowTitle(window, title.str().c_str());
     }
 
+	loaderThread.stop();
+
 	SDL_DestroyWindow(window);
 
     SDL_Quit();
@@ -0,0 +1,192 @@
+#pragma once
+
+#include <cassert>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <GL/glew.h>
+#include <SDL2/SDL.h>
+
+#include "SpscQueue.h"
+
+// runs jobs on a thread with its own GL context sharing objects with the render context
+// once the GL commands of a job have completed, its completion callback runs on the render thread in poll()
+class GLLoaderThread
+{
+public:
+	using Job = std::function<void()>;
+	using Completion = std::function<void()>;
+
+	// must be called from the render thread with renderContext current, the debug callback of the render context
+	// is installed on the loader context as well
+	GLLoaderThread(SDL_Window* window, SDL_GLContext renderContext)
+		: m_window(window)
+		, m_debugCallback(nullptr)
+		, m_debugUserParam(nullptr)
+		, m_running(true)
+	{
+		void* debugCallback = nullptr;
+		glGetPointerv(GL_DEBUG_CALLBACK_FUNCTION, &debugCallback);
+		glGetPointerv(GL_DEBUG_CALLBACK_USER_PARAM, &m_debugUserParam);
+		m_debugCallback = reinterpret_cast<GLDEBUGPROC>(debugCallback);
+
+		SDL_GL_SetAttribute(SDL_GL_SHARE_WITH_CURRENT_CONTEXT, 1);
+		m_context = SDL_GL_CreateContext(window);
+		assert(m_context != nullptr);
+		SDL_GL_SetAttribute(SDL_GL_SHARE_WITH_CURRENT_CONTEXT, 0);
+
+		// creating a context makes it current
+		SDL_GL_MakeCurrent(window, renderContext);
+
+		m_thread = std::thread(&GLLoaderThread::run, this);
+	}
+
+	GLLoaderThread(const GLLoaderThread&) = delete;
+	void operator=(const GLLoaderThread&) = delete;
+
+	~GLLoaderThread()
+	{
+		stop();
+	}
+
+	// jobs that have not started yet are dropped, and so are the completions left once the render thread
+	// stopped polling
+	void stop()
+	{
+		if (!m_thread.joinable())
+		{
+			return;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(m_jobsMutex);
+			m_running = false;
+		}
+		m_jobsCondition.notify_one();
+		m_thread.join();
+
+		while (PublishedJob* publishedJob = m_publishedJobs.front())
+		{
+			glDeleteSync(publishedJob->fence);
+			m_publishedJobs.pop();
+		}
+		SDL_GL_DeleteContext(m_context);
+	}
+
+	void post(Job job, Completion completion = nullptr)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_jobsMutex);
+			m_jobs.push_back({ std::move(job), std::move(completion) });
+		}
+		m_jobsCondition.notify_one();
+	}
+
+	// to call from the render thread every frame, never blocks
+	void poll()
+	{
+		while (PublishedJob* publishedJob = m_publishedJobs.front())
+		{
+			const GLenum result = glClientWaitSync(publishedJob->fence, 0, 0);
+			if (result == GL_TIMEOUT_EXPIRED)
+			{
+				break;
+			}
+			assert(result != GL_WAIT_FAILED);
+			glDeleteSync(publishedJob->fence);
+
+			Completion completion = std::move(publishedJob->completion);
+			m_publishedJobs.pop();
+			if (completion)
+			{
+				completion();
+			}
+		}
+	}
+
+protected:
+	static constexpr size_t MaxPublishedJobs = 64;
+
+	struct PendingJob
+	{
+		Job job;
+		Completion completion;
+	};
+
+	struct PublishedJob
+	{
+		GLsync fence = nullptr;
+		Completion completion;
+	};
+
+	bool isRunning()
+	{
+		std::lock_guard<std::mutex> lock(m_jobsMutex);
+		return m_running;
+	}
+
+	void run()
+	{
+		SDL_GL_MakeCurrent(m_window, m_context);
+
+		if (m_debugCallback != nullptr)
+		{
+			glDebugMessageCallback(m_debugCallback, m_debugUserParam);
+			glEnable(GL_DEBUG_OUTPUT);
+			glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+			glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DEBUG_SEVERITY_NOTIFICATION, 0, nullptr, GL_FALSE);
+		}
+
+		while (true)
+		{
+			PendingJob pendingJob;
+			{
+				std::unique_lock<std::mutex> lock(m_jobsMutex);
+				m_jobsCondition.wait(lock, [this]() { return !m_running || !m_jobs.empty(); });
+				if (!m_running)
+				{
+					break;
+				}
+				pendingJob = std::move(m_jobs.front());
+				m_jobs.pop_front();
+			}
+
+			pendingJob.job();
+
+			// the fence must reach the GPU before the render context can wait on it
+			PublishedJob publishedJob;
+			publishedJob.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			publishedJob.completion = std::move(pendingJob.completion);
+			glFlush();
+
+			// the queue stays full if the render thread stops polling, stop() must not wait for room forever
+			while (!m_publishedJobs.push(std::move(publishedJob)))
+			{
+				if (!isRunning())
+				{
+					glDeleteSync(publishedJob.fence);
+					break;
+				}
+				std::this_thread::yield();
+			}
+		}
+
+		SDL_GL_MakeCurrent(m_window, nullptr);
+	}
+
+protected:
+	SDL_Window* m_window;
+	SDL_GLContext m_context;
+	GLDEBUGPROC m_debugCallback;
+	void* m_debugUserParam;
+	std::thread m_thread;
+
+	std::mutex m_jobsMutex;
+	std::condition_variable m_jobsCondition;
+	std::deque<PendingJob> m_jobs;
+	bool m_running;
+
+	SpscQueue<PublishedJob, MaxPublishedJobs> m_publishedJobs;
+};
@@ -0,0 +1,185 @@
+#pragma once
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <GL/glew.h>
+
+// global accounting of GPU memory and uploads per named resource
+// resources sharing a name are accumulated in the same entry
+class GLMemoryRegistry
+{
+public:
+	struct ResourceStats
+	{
+		std::string name;
+		GLsizeiptr liveBytes = 0;
+		GLsizeiptr peakBytes = 0;
+		GLsizeiptr frameUploadBytes = 0;
+		GLsizeiptr lastFrameUploadBytes = 0;
+		GLsizeiptr totalUploadBytes = 0;
+		int allocationCount = 0;
+	};
+
+	static GLMemoryRegistry& getInstance()
+	{
+		static GLMemoryRegistry instance;
+		return instance;
+	}
+
+	void addAllocation(const std::string& name, GLsizeiptr size)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		ResourceStats& stats = findOrAddStats(name);
+		stats.liveBytes += size;
+		stats.peakBytes = std::max(stats.peakBytes, stats.liveBytes);
+		++stats.allocationCount;
+
+		m_liveBytes += size;
+		m_peakBytes = std::max(m_peakBytes, m_liveBytes);
+	}
+
+	void removeAllocation(const std::string& name, GLsizeiptr size)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		ResourceStats& stats = findOrAddStats(name);
+		stats.liveBytes -= size;
+
+		m_liveBytes -= size;
+	}
+
+	// moves live bytes to another name without counting a new allocation
+	void renameAllocation(const std::string& previousName, const std::string& name, GLsizeiptr size)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		findOrAddStats(previousName).liveBytes -= size;
+		ResourceStats& stats = findOrAddStats(name);
+		stats.liveBytes += size;
+		stats.peakBytes = std::max(stats.peakBytes, stats.liveBytes);
+	}
+
+	void addUpload(const std::string& name, GLsizeiptr size)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		ResourceStats& stats = findOrAddStats(name);
+		stats.frameUploadBytes += size;
+		stats.totalUploadBytes += size;
+
+		m_frameUploadBytes += size;
+	}
+
+	// to call once per frame, per frame upload counters restart from zero
+	void endFrame()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for (std::pair<const std::string, ResourceStats>& stats : m_stats)
+		{
+			stats.second.lastFrameUploadBytes = stats.second.frameUploadBytes;
+			stats.second.frameUploadBytes = 0;
+		}
+		m_lastFrameUploadBytes = m_frameUploadBytes;
+		m_frameUploadBytes = 0;
+	}
+
+	std::vector<ResourceStats> getAllStats() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		std::vector<ResourceStats> allStats;
+		allStats.reserve(m_stats.size());
+		for (const std::pair<const std::string, ResourceStats>& stats : m_stats)
+		{
+			allStats.push_back(stats.second);
+		}
+		return allStats;
+	}
+
+	ResourceStats getStats(const std::string& name) const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		std::map<std::string, ResourceStats>::const_iterator it = m_stats.find(name);
+		return it != m_stats.end() ? it->second : ResourceStats();
+	}
+
+	GLsizeiptr getLiveBytes() const { std::lock_guard<std::mutex> lock(m_mutex); return m_liveBytes; }
+	GLsizeiptr getPeakBytes() const { std::lock_guard<std::mutex> lock(m_mutex); return m_peakBytes; }
+	GLsizeiptr getLastFrameUploadBytes() const { std::lock_guard<std::mutex> lock(m_mutex); return m_lastFrameUploadBytes; }
+
+	void dumpCsv(std::ostream& out) const
+	{
+		out << "name,liveBytes,peakBytes,lastFrameUploadBytes,totalUploadBytes,allocationCount\n";
+		for (const ResourceStats& stats : getAllStats())
+		{
+			out << stats.name << ','
+				<< stats.liveBytes << ','
+				<< stats.peakBytes << ','
+				<< stats.lastFrameUploadBytes << ','
+				<< stats.totalUploadBytes << ','
+				<< stats.allocationCount << '\n';
+		}
+	}
+
+	void dumpJson(std::ostream& out) const
+	{
+		out << "{\n"
+			<< "\t\"liveBytes\": " << getLiveBytes() << ",\n"
+			<< "\t\"peakBytes\": " << getPeakBytes() << ",\n"
+			<< "\t\"lastFrameUploadBytes\": " << getLastFrameUploadBytes() << ",\n"
+			<< "\t\"resources\": [";
+		bool first = true;
+		for (const ResourceStats& stats : getAllStats())
+		{
+			out << (first ? "\n" : ",\n")
+				<< "\t\t{ \"name\": \"" << escapeJson(stats.name) << "\""
+				<< ", \"liveBytes\": " << stats.liveBytes
+				<< ", \"peakBytes\": " << stats.peakBytes
+				<< ", \"lastFrameUploadBytes\": " << stats.lastFrameUploadBytes
+				<< ", \"totalUploadBytes\": " << stats.totalUploadBytes
+				<< ", \"allocationCount\": " << stats.allocationCount
+				<< " }";
+			first = false;
+		}
+		out << "\n\t]\n}\n";
+	}
+
+protected:
+	GLMemoryRegistry()
+		: m_liveBytes(0)
+		, m_peakBytes(0)
+		, m_frameUploadBytes(0)
+		, m_lastFrameUploadBytes(0)
+	{
+
+	}
+
+	ResourceStats& findOrAddStats(const std::string& name)
+	{
+		ResourceStats& stats = m_stats[name];
+		stats.name = name;
+		return stats;
+	}
+
+	static std::string escapeJson(const std::string& string)
+	{
+		std::string escaped;
+		for (char c : string)
+		{
+			if (c == '"' || c == '\\')
+			{
+				escaped += '\\';
+			}
+			escaped += c;
+		}
+		return escaped;
+	}
+
+protected:
+	mutable std::mutex m_mutex;
+	std::map<std::string, ResourceStats> m_stats;
+	GLsizeiptr m_liveBytes;
+	GLsizeiptr m_peakBytes;
+	GLsizeiptr m_frameUploadBytes;
+	GLsizeiptr m_lastFrameUploadBytes;
+};
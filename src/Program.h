@@ -34,6 +34,14 @@ public:
 		m_programId = compileProgram(fragmentShaderId, vertexShaderId);
 	}
 
+	void loadCompute(const std::string& computeShader)
+	{
+		m_computeShader = computeShader;
+
+		const GLuint computeShaderId = compileShader(computeShader, GL_COMPUTE_SHADER);
+		m_programId = compileProgram(computeShaderId);
+	}
+
 	void use() const
 	{
 		glUseProgram(m_programId);
@@ -61,6 +69,24 @@ protected:
 		return programId;
 	}
 
+	GLuint compileProgram(GLuint computeShaderId)
+	{
+		GLuint programId = glCreateProgram();
+		glAttachShader(programId, computeShaderId);
+		glLinkProgram(programId);
+
+		char buffer[8192];
+		GLsizei length = 0;
+		glGetProgramInfoLog(programId, sizeof(buffer), &length, buffer);
+		if (length)
+		{
+			printf("%s\n", buffer);
+			assert(false);
+		}
+
+		return programId;
+	}
+
 	GLuint compileShader(const std::string& shader, GLuint shaderType)
 	{
 		std::string shaderCode;
@@ -91,6 +117,7 @@ protected:
 protected:
 	std::string m_fragmentShader;
 	std::string m_vertexShader;
+	std::string m_computeShader;
 
 	GLuint m_programId;
 };
\ No newline at end of file
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "WorkerThreads.h"
+
+struct RadixSortItem
+{
+	std::uint32_t key;
+	std::uint32_t value;
+};
+
+// maps a float to an unsigned key with the same ordering
+inline std::uint32_t getRadixSortKey(float f)
+{
+	std::uint32_t bits;
+	std::memcpy(&bits, &f, sizeof(bits));
+	return (bits & 0x80000000u) ? ~bits : (bits | 0x80000000u);
+}
+
+// stable least significant digit radix sort on 8-bit digits, each pass splits the items between threads:
+// every thread counts the digits of its own items, the counts are prefix summed in (digit, thread) order
+// so that every thread scatters its items to disjoint ranges of the output
+class RadixSort
+{
+public:
+	static constexpr int DigitBits = 8;
+	static constexpr int NumDigits = 1 << DigitBits;
+	// below this, a single thread is faster than waking the others
+	static constexpr size_t MinItemsPerThread = 16 * 1024;
+
+	// the threads of the pool are shared with its other users, the pool must outlive the sort
+	RadixSort(WorkerThreads& workerThreads)
+		: m_workerThreads(workerThreads)
+	{
+
+	}
+
+	void sort(std::vector<RadixSortItem>& items)
+	{
+		const size_t numItems = items.size();
+		const unsigned int numThreads = m_workerThreads.getThreadCount(numItems, MinItemsPerThread);
+		m_scratch.resize(numItems);
+		m_counts.resize(numThreads);
+
+		std::vector<RadixSortItem>* input = &items;
+		std::vector<RadixSortItem>* output = &m_scratch;
+		for (int shift = 0; shift < 32; shift += DigitBits)
+		{
+			m_workerThreads.run(numThreads, [&](unsigned int thread)
+			{
+				const auto [first, last] = WorkerThreads::getThreadRange(numItems, numThreads, thread);
+				Counts& counts = m_counts[thread];
+				counts.fill(0);
+				for (size_t i = first; i < last; ++i)
+				{
+					++counts[((*input)[i].key >> shift) & (NumDigits - 1)];
+				}
+			});
+
+			// exclusive prefix sum, digit major so that the sort stays stable
+			size_t offset = 0;
+			for (int digit = 0; digit < NumDigits; ++digit)
+			{
+				for (unsigned int thread = 0; thread < numThreads; ++thread)
+				{
+					const size_t count = m_counts[thread][digit];
+					m_counts[thread][digit] = offset;
+					offset += count;
+				}
+			}
+			assert(offset == numItems);
+
+			m_workerThreads.run(numThreads, [&](unsigned int thread)
+			{
+				const auto [first, last] = WorkerThreads::getThreadRange(numItems, numThreads, thread);
+				Counts& offsets = m_counts[thread];
+				for (size_t i = first; i < last; ++i)
+				{
+					const RadixSortItem& item = (*input)[i];
+					(*output)[offsets[(item.key >> shift) & (NumDigits - 1)]++] = item;
+				}
+			});
+
+			std::swap(input, output);
+		}
+
+		// an even number of passes leaves the result in the items
+		static_assert((32 / DigitBits) % 2 == 0);
+	}
+
+protected:
+	using Counts = std::array<size_t, NumDigits>;
+
+	WorkerThreads& m_workerThreads;
+	std::vector<RadixSortItem> m_scratch;
+	std::vector<Counts> m_counts;
+};
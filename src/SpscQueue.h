@@ -0,0 +1,57 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+// lock-free queue for exactly one producer thread and one consumer thread
+template <class T, size_t Capacity>
+class SpscQueue
+{
+public:
+	SpscQueue()
+		: m_head(0)
+		, m_tail(0)
+	{
+
+	}
+
+	// producer side, fails if the queue is full
+	bool push(T&& item)
+	{
+		const size_t tail = m_tail.load(std::memory_order_relaxed);
+		const size_t nextTail = (tail + 1) % Capacity;
+		if (nextTail == m_head.load(std::memory_order_acquire))
+		{
+			return false;
+		}
+		m_items[tail] = std::move(item);
+		m_tail.store(nextTail, std::memory_order_release);
+		return true;
+	}
+
+	// consumer side, returns nullptr if the queue is empty
+	T* front()
+	{
+		const size_t head = m_head.load(std::memory_order_relaxed);
+		if (head == m_tail.load(std::memory_order_acquire))
+		{
+			return nullptr;
+		}
+		return &m_items[head];
+	}
+
+	// consumer side, only valid after front() returned an item
+	void pop()
+	{
+		const size_t head = m_head.load(std::memory_order_relaxed);
+		m_items[head] = T();
+		m_head.store((head + 1) % Capacity, std::memory_order_release);
+	}
+
+protected:
+	std::array<T, Capacity> m_items;
+	alignas(64) std::atomic<size_t> m_head;
+	alignas(64) std::atomic<size_t> m_tail;
+};
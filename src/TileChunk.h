@@ -0,0 +1,334 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <GL/glew.h>
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+#include "TileMesh.h"
+#include "UploadQueue.h"
+
+// square of cells of a map, the chunk keeps its tiles on the CPU and only takes tile slots of the mesh while loaded
+class TileChunk
+{
+public:
+	static constexpr int Size = 32;
+	// the clusters of a chunk don't mix with the tiles of its neighbours
+	static_assert(Size % TileMesh::ClusterSize == 0);
+
+	TileChunk(const TileChunk&) = delete;
+	TileChunk(TileChunk&&) = delete;
+	void operator=(const TileChunk&) = delete;
+	void operator=(TileChunk&&) = delete;
+
+	TileChunk(const glm::ivec2& coords)
+		: m_coords(coords)
+		, m_dirty(false)
+		, m_loaded(false)
+		, m_residentBytes(0)
+	{
+		clearBounds();
+	}
+
+	// the tile must lie in one of the cells of the chunk
+	void addTile(const glm::vec3& position, int tileTemplateIndex)
+	{
+		assert(isInside(TileMesh::getTileCell(position)));
+		m_tiles.push_back({ position, tileTemplateIndex });
+		m_boundsMin.z = std::min(m_boundsMin.z, position.z);
+		m_boundsMax.z = std::max(m_boundsMax.z, position.z);
+		m_dirty = true;
+	}
+
+	// replaces all the tiles of the chunk, the tiles outside of its cells are dropped
+	void setTiles(std::vector<TileMesh::TilePlacement>&& tiles)
+	{
+		clearTiles();
+		m_tiles = std::move(tiles);
+		m_tiles.erase(std::remove_if(m_tiles.begin(), m_tiles.end(), [this](const TileMesh::TilePlacement& tile)
+		{
+			return !isInside(TileMesh::getTileCell(tile.position));
+		}), m_tiles.end());
+		for (const TileMesh::TilePlacement& tile : m_tiles)
+		{
+			m_boundsMin.z = std::min(m_boundsMin.z, tile.position.z);
+			m_boundsMax.z = std::max(m_boundsMax.z, tile.position.z);
+		}
+	}
+
+	void clearTiles()
+	{
+		m_tiles.clear();
+		clearBounds();
+		m_dirty = true;
+	}
+
+	// places the tiles in blocks of slots of the mesh, the tiles must then be uploaded with the mesh
+	void load(TileMesh& tileMesh)
+	{
+		assert(!m_loaded);
+		for (size_t first = 0; first < m_tiles.size(); first += TileMesh::TileBlockSize)
+		{
+			const GLuint count = static_cast<GLuint>(std::min<size_t>(TileMesh::TileBlockSize, m_tiles.size() - first));
+			m_slotRanges.push_back({ tileMesh.allocateTileBlock(), count });
+		}
+		tileMesh.placeTiles(m_slotRanges, [this](size_t i)
+		{
+			return m_tiles[i];
+		});
+		m_residentBytes = static_cast<GLsizeiptr>(m_slotRanges.size()) * TileMesh::TileBlockSize * TileMesh::TileSlotBytes
+			+ static_cast<GLsizeiptr>(tileMesh.getClusterCount(m_slotRanges)) * TileMesh::ClusterBytes;
+		m_loaded = true;
+		m_dirty = false;
+	}
+
+	// the tiles stay in the chunk to be loaded again
+	void unload(TileMesh& tileMesh)
+	{
+		assert(m_loaded);
+		tileMesh.removeTiles(m_slotRanges);
+		for (const TileMesh::TileSlotRange& slots : m_slotRanges)
+		{
+			tileMesh.releaseTileBlock(slots.firstTileIndex);
+		}
+		m_slotRanges.clear();
+		m_residentBytes = 0;
+		m_loaded = false;
+	}
+
+	bool isInside(const glm::ivec2& cell) const
+	{
+		const glm::ivec2 firstCell = m_coords * Size;
+		return glm::all(glm::greaterThanEqual(cell, firstCell)) && glm::all(glm::lessThan(cell, firstCell + Size));
+	}
+
+	const glm::ivec2& getCoords() const { return m_coords; }
+	const std::vector<TileMesh::TilePlacement>& getTiles() const { return m_tiles; }
+	// the cells of the chunk and the height range of the tile positions, empty in z without tiles
+	const glm::vec3& getBoundsMin() const { return m_boundsMin; }
+	const glm::vec3& getBoundsMax() const { return m_boundsMax; }
+	// tiles added or cleared since the chunk was loaded
+	bool isDirty() const { return m_dirty; }
+	bool isLoaded() const { return m_loaded; }
+
+	// tiles placed in the mesh by the last load
+	size_t getLoadedTileCount() const
+	{
+		size_t loadedTileCount = 0;
+		for (const TileMesh::TileSlotRange& slots : m_slotRanges)
+		{
+			loadedTileCount += slots.count;
+		}
+		return loadedTileCount;
+	}
+
+	// GPU bytes of the tile slots and the clusters taken in the mesh by the last load, see TileMesh::TileSlotBytes,
+	// counted from the clusters of the chunk as placed and their largest merged tops
+	GLsizeiptr getResidentBytes() const { return m_residentBytes; }
+
+protected:
+	void clearBounds()
+	{
+		const glm::vec2 firstCell = glm::vec2(m_coords * Size) - 0.5f;
+		m_boundsMin = glm::vec3(firstCell, std::numeric_limits<float>::max());
+		m_boundsMax = glm::vec3(firstCell + static_cast<float>(Size), std::numeric_limits<float>::lowest());
+	}
+
+protected:
+	glm::ivec2 m_coords;
+	std::vector<TileMesh::TilePlacement> m_tiles;
+	glm::vec3 m_boundsMin;
+	glm::vec3 m_boundsMax;
+	bool m_dirty;
+	bool m_loaded;
+	// a block per TileMesh::TileBlockSize tiles, only the first count slots of the last block are used
+	std::vector<TileMesh::TileSlotRange> m_slotRanges;
+	GLsizeiptr m_residentBytes;
+};
+
+// chunks of a map without bounds, the chunks are loaded and unloaded independently so that the map can hold
+// more tiles than the mesh as long as the loaded ones fit, only the chunks whose cells fit in the 16-bit cells of
+// the tile data can be added
+class TileChunkMap
+{
+public:
+	TileChunkMap(const TileChunkMap&) = delete;
+	TileChunkMap(TileChunkMap&&) = delete;
+	void operator=(const TileChunkMap&) = delete;
+	void operator=(TileChunkMap&&) = delete;
+
+	TileChunkMap(TileMesh& tileMesh)
+		: m_tileMesh(tileMesh)
+		, m_loadedChunkCount(0)
+		, m_loadedTileCount(0)
+		, m_residentBytes(0)
+		, m_uploadQueue(nullptr)
+		, m_changed(false)
+	{
+	}
+
+	// the mesh must outlive the map
+	~TileChunkMap()
+	{
+		for (auto& [key, chunk] : m_chunks)
+		{
+			if (chunk->isLoaded())
+			{
+				unloadChunk(*chunk);
+			}
+		}
+	}
+
+	// rounds towards negative infinity
+	static glm::ivec2 getChunkCoords(const glm::ivec2& cell)
+	{
+		return glm::ivec2(
+			cell.x >= 0 ? cell.x / TileChunk::Size : (cell.x + 1) / TileChunk::Size - 1,
+			cell.y >= 0 ? cell.y / TileChunk::Size : (cell.y + 1) / TileChunk::Size - 1
+		);
+	}
+
+	static glm::ivec2 getChunkCoords(const glm::vec3& position)
+	{
+		return getChunkCoords(TileMesh::getTileCell(position));
+	}
+
+	// the chunks line up with the range of the cells, their cells all fit or none does
+	static bool isChunkInRange(const glm::ivec2& coords)
+	{
+		static_assert((TileDataMaxCell + 1) % TileChunk::Size == 0);
+		return isTileDataCellInRange(coords * TileChunk::Size);
+	}
+
+	// the chunk of the tile is created if needed, a loaded chunk is loaded again by the next update(),
+	// returns false without adding the tile when its cell doesn't fit in the tile data
+	bool addTile(const glm::vec3& position, int tileTemplateIndex)
+	{
+		const glm::ivec2 coords = getChunkCoords(position);
+		if (!isChunkInRange(coords))
+		{
+			return false;
+		}
+		getOrAddChunk(coords).addTile(position, tileTemplateIndex);
+		return true;
+	}
+
+	TileChunk* findChunk(const glm::ivec2& coords)
+	{
+		auto it = m_chunks.find(getChunkKey(coords));
+		return it != m_chunks.end() ? it->second.get() : nullptr;
+	}
+
+	TileChunk& getOrAddChunk(const glm::ivec2& coords)
+	{
+		assert(isChunkInRange(coords));
+		std::unique_ptr<TileChunk>& chunk = m_chunks[getChunkKey(coords)];
+		if (chunk == nullptr)
+		{
+			chunk = std::make_unique<TileChunk>(coords);
+		}
+		return *chunk;
+	}
+
+	void loadChunk(TileChunk& chunk)
+	{
+		chunk.load(m_tileMesh);
+		++m_loadedChunkCount;
+		m_loadedTileCount += chunk.getLoadedTileCount();
+		m_residentBytes += chunk.getResidentBytes();
+		m_changed = true;
+	}
+
+	void unloadChunk(TileChunk& chunk)
+	{
+		m_loadedTileCount -= chunk.getLoadedTileCount();
+		m_residentBytes -= chunk.getResidentBytes();
+		--m_loadedChunkCount;
+		chunk.unload(m_tileMesh);
+		m_changed = true;
+	}
+
+	// the chunk must not be loaded
+	void removeChunk(const glm::ivec2& coords)
+	{
+		auto it = m_chunks.find(getChunkKey(coords));
+		assert(it != m_chunks.end() && !it->second->isLoaded());
+		m_chunks.erase(it);
+	}
+
+	bool isChunkLoaded(const glm::ivec2& coords)
+	{
+		const TileChunk* chunk = findChunk(coords);
+		return chunk != nullptr && chunk->isLoaded();
+	}
+
+	// the new commands of the mesh are streamed through the queue instead of being uploaded at once, the queue must
+	// be processed every frame on the render thread and outlive the map, nullptr uploads at once
+	void setUploadQueue(GLUploadQueue* uploadQueue)
+	{
+		m_uploadQueue = uploadQueue;
+	}
+
+	// loads again the loaded chunks whose tiles changed, then uploads the mesh if any chunk was loaded or unloaded
+	void update()
+	{
+		for (auto& [key, chunk] : m_chunks)
+		{
+			if (chunk->isLoaded() && chunk->isDirty())
+			{
+				unloadChunk(*chunk);
+				loadChunk(*chunk);
+			}
+		}
+		if (m_changed)
+		{
+			if (m_uploadQueue != nullptr)
+			{
+				m_tileMesh.upload(*m_uploadQueue);
+			}
+			else
+			{
+				m_tileMesh.upload();
+			}
+			m_changed = false;
+		}
+	}
+
+	template <class Func>
+	void forEachChunk(Func func)
+	{
+		for (auto& [key, chunk] : m_chunks)
+		{
+			func(*chunk);
+		}
+	}
+
+	TileMesh& getTileMesh() { return m_tileMesh; }
+	size_t getChunkCount() const { return m_chunks.size(); }
+	size_t getLoadedChunkCount() const { return m_loadedChunkCount; }
+	size_t getLoadedTileCount() const { return m_loadedTileCount; }
+	// GPU bytes of the tile slots and the clusters taken by the loaded chunks
+	GLsizeiptr getResidentBytes() const { return m_residentBytes; }
+
+	static std::int64_t getChunkKey(const glm::ivec2& coords)
+	{
+		return static_cast<std::int64_t>((static_cast<std::uint64_t>(coords.x) << 32) ^ (static_cast<std::uint64_t>(coords.y) & 0xFFFFFFFF));
+	}
+
+protected:
+	TileMesh& m_tileMesh;
+	std::unordered_map<std::int64_t, std::unique_ptr<TileChunk>> m_chunks;
+	size_t m_loadedChunkCount;
+	size_t m_loadedTileCount;
+	GLsizeiptr m_residentBytes;
+	GLUploadQueue* m_uploadQueue;
+	// chunks were loaded or unloaded since the last upload
+	bool m_changed;
+};
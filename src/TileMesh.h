@@ -1,16 +1,32 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
 #include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <random>
+#include <type_traits>
+#include <unordered_map>
 #include <vector>
 #include <GL/glew.h>
 #define GLM_FORCE_RADIANS
 #include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
 
 #include "Axes.h"
 #include "BindlessTexture.h"
 #include "Buffer.h"
+#include "BufferAllocator.h"
+#include "DepthPyramid.h"
+#include "LoaderThread.h"
 #include "Program.h"
+#include "RadixSort.h"
 #include "TileTemplate.h"
+#include "UploadQueue.h"
+#include "WorkerThreads.h"
 
 /*
 /  0  \
@@ -23,34 +39,188 @@
 \ 7 11/
 */
 
+// top, left side, right side and top again so that every combination of faces is a contiguous range
 const GLuint tileIndices[] = {
 	0, 1, 2,
 	1, 2, 3,
 	4, 5, 6,
 	6, 5, 7,
 	8, 9, 10,
-	10, 9, 11
+	10, 9, 11,
+	0, 1, 2,
+	1, 2, 3
 };
 
-struct TileVertex
+// faces of a tile to draw
+enum TileFaceMask : GLuint
 {
-	glm::vec3 position;
-	glm::vec3 normal;
-	glm::vec2 uv;
+	TileFaceMask_None = 0,
+	TileFaceMask_Left = 1 << 0,
+	TileFaceMask_Right = 1 << 1,
+	TileFaceMask_Top = 1 << 2,
+	TileFaceMask_All = TileFaceMask_Left | TileFaceMask_Right | TileFaceMask_Top,
+	TileFaceMask_Count,
+	// not a face, the top is drawn by a merged top when merging is enabled
+	TileFaceMask_TopMerged = 1 << 3
+};
+
+struct TileIndexRange
+{
+	GLuint firstIndex;
+	GLuint count;
 };
 
-struct alignas(16) TileData
+// range of tileIndices for each face mask
+const TileIndexRange tileFaceMaskIndexRanges[TileFaceMask_Count] = {
+	{ 0, 0 },
+	{ 6, 6 },
+	{ 12, 6 },
+	{ 6, 12 },
+	{ 0, 6 },
+	{ 0, 12 },
+	{ 12, 12 },
+	{ 0, 18 }
+};
+
+// vertex of the shape of the tiles of a template, laid out to be read from a shader storage buffer
+struct alignas(16) TileVertex
 {
 	glm::vec4 position;
-	unsigned int tileTemplateIndex;
-	unsigned int tileVariantIndex;
+	glm::vec4 normal;
+	glm::vec2 uv;
+};
+
+constexpr GLuint TileVertexCount = 12;
+
+// packed to 8 bytes: the cell of the tile as two signed 16-bit integers, then its height in fixed point, its template, its variant and its face mask
+struct TileData
+{
+	GLuint cell;
+	GLuint bits;
+};
+
+static_assert(sizeof(TileData) == 8);
+
+constexpr int TileDataHeightBits = 15;
+constexpr int TileDataTemplateBits = 8;
+constexpr int TileDataVariantBits = 5;
+constexpr int TileDataFaceMaskBits = 4;
+static_assert(TileDataHeightBits + TileDataTemplateBits + TileDataVariantBits + TileDataFaceMaskBits == 32);
+constexpr int TileDataTemplateShift = TileDataHeightBits;
+constexpr int TileDataVariantShift = TileDataTemplateShift + TileDataTemplateBits;
+constexpr int TileDataFaceMaskShift = TileDataVariantShift + TileDataVariantBits;
+// heights are multiples of 1/128 between -128 and 128
+constexpr float TileDataHeightStepsPerUnit = 128.f;
+// cells are signed 16-bit integers
+constexpr int TileDataCellBits = 16;
+constexpr int TileDataMinCell = -(1 << (TileDataCellBits - 1));
+constexpr int TileDataMaxCell = (1 << (TileDataCellBits - 1)) - 1;
+
+inline bool isTileDataCellInRange(const glm::ivec2& cell)
+{
+	return glm::all(glm::greaterThanEqual(cell, glm::ivec2(TileDataMinCell))) && glm::all(glm::lessThanEqual(cell, glm::ivec2(TileDataMaxCell)));
+}
+
+inline int getTileDataHeightSteps(float height)
+{
+	const int steps = static_cast<int>(std::round(height * TileDataHeightStepsPerUnit));
+	assert(-(1 << (TileDataHeightBits - 1)) <= steps && steps < (1 << (TileDataHeightBits - 1)));
+	return steps;
+}
+
+// the height a tile is drawn at
+inline float quantizeTileHeight(float height)
+{
+	return static_cast<float>(getTileDataHeightSteps(height)) / TileDataHeightStepsPerUnit;
+}
+
+inline TileData packTileData(const glm::ivec2& cell, float height, GLuint tileTemplateIndex, GLuint tileVariantIndex, GLuint faceMask)
+{
+	assert(isTileDataCellInRange(cell));
+	assert(tileTemplateIndex < (1u << TileDataTemplateBits));
+	assert(tileVariantIndex < (1u << TileDataVariantBits));
+	assert(faceMask < (1u << TileDataFaceMaskBits));
+	TileData tileData;
+	tileData.cell = (static_cast<GLuint>(cell.x) & 0xFFFF) | (static_cast<GLuint>(cell.y) << 16);
+	tileData.bits = (static_cast<GLuint>(getTileDataHeightSteps(height)) & ((1u << TileDataHeightBits) - 1))
+		| (tileTemplateIndex << TileDataTemplateShift)
+		| (tileVariantIndex << TileDataVariantShift)
+		| (faceMask << TileDataFaceMaskShift);
+	return tileData;
+}
+
+// bounds of a cluster of neighbouring tiles, including the height of their geometry
+struct alignas(16) TileClusterData
+{
+	glm::vec4 boundsMin;
+	glm::vec4 boundsMax;
+	GLuint tileCount;
+	GLuint firstMergedTop;
+	GLuint mergedTopCount;
+};
+
+// a rectangle of coplanar tile tops of the same template drawn as a single quad, origin is the center of its first tile
+struct alignas(16) MergedTopData
+{
+	glm::vec4 origin;
+	glm::vec2 size;
+	GLuint tileTemplateIndex;
+	GLuint tileVariantIndex;
 };
 
 class TileMesh
 {
 public:
 	static constexpr int MaxTileTemplates = 256;
+	static_assert(MaxTileTemplates <= 1 << TileDataTemplateBits);
 	static constexpr int MaxTiles = 1024 * 1024;
+	// consecutive tiles with the same geometry are drawn by a single instanced command,
+	// commands are capped so that streamed tiles still show up progressively
+	static constexpr GLuint MaxTilesPerCommand = 16 * 1024;
+	static constexpr int MaxCommands = 4096;
+	// tiles are grouped in square clusters culled as a whole before their tiles are tested
+	static constexpr int ClusterSize = 8;
+	static constexpr GLuint MaxTilesPerCluster = ClusterSize * ClusterSize;
+	// partial clusters on the map borders and stacked tiles need more than MaxTiles / MaxTilesPerCluster
+	static constexpr int MaxTileClusters = MaxTiles / 16;
+	// one geometry per template, the visible tiles of each geometry and face mask are drawn by a single command
+	static constexpr int MaxGeometries = MaxTileTemplates;
+	static constexpr int MaxDrawGroups = MaxGeometries * TileFaceMask_Count;
+	// merged tops cover at least two tiles, each cluster owns a range of them rounded up to a power of two
+	static constexpr GLuint MaxMergedTopsPerCluster = MaxTilesPerCluster / 2;
+	static constexpr int MaxMergedTops = MaxTiles;
+
+	// tiles are written straight into mapped GPU memory instead of a CPU copy uploaded afterwards
+	static constexpr bool ZeroCopyTiles = true;
+	using TilesBuffer = std::conditional_t<
+		ZeroCopyTiles,
+		GLMappedArrayBuffer<TileData, MaxTiles>,
+		GLArrayBuffer<TileData, MaxTiles>
+	>;
+
+	// a tile to add with addTiles() or placeTiles()
+	struct TilePlacement
+	{
+		glm::vec3 position;
+		int tileTemplateIndex;
+	};
+
+	// consecutive tile slots
+	struct TileSlotRange
+	{
+		GLuint firstTileIndex;
+		GLuint count;
+	};
+
+	// tile slots handed out at once to the chunks of a map
+	static constexpr GLuint TileBlockSize = 1024;
+
+	// GPU bytes growing with the tiles: the tile data and the culled instance of each tile slot, then the data of
+	// each cluster, its tile slots, its place in the cluster order and its largest range of merged tops with their
+	// culled instances, the buffers sized by the templates and the draw groups are left out
+	static constexpr GLsizeiptr TileSlotBytes = sizeof(TileData) + sizeof(GLuint);
+	static constexpr GLsizeiptr ClusterBytes = sizeof(TileClusterData) + (MaxTilesPerCluster + 1) * sizeof(GLuint)
+		+ MaxMergedTopsPerCluster * (sizeof(MergedTopData) + sizeof(GLuint));
 
 	struct PerFrameData
 	{
@@ -61,9 +231,136 @@ public:
 		glm::vec4 lightDirection;
 	};
 
-	TileMesh(const TileTemplate& tileTemplate)
-		: m_indicesBuffer(tileIndices, sizeof(tileIndices))
+	TileMesh()
+		: m_hasTranslucentTemplates(false)
+		, m_indicesBuffer(tileIndices, sizeof(tileIndices))
+		, m_tileBoundsMin(-0.5f, -0.5f, 0.f)
+		, m_tileBoundsMax(0.5f, 0.5f, 0.f)
+		, m_zoom(1.f)
+		, m_mergeTopsMaxZoom(0.f)
+		, m_drawGroupsDirty(false)
+		, m_drawGroupsMergingTops(false)
+		, m_viewRotation(0.f)
+		, m_sortedQuadrant(-1)
+		, m_sortedClusterCount(0)
+		, m_clusterOrderDirty(false)
+		, m_radixSort(m_workerThreads)
+		, m_occlusionCulling(true)
+		, m_depthPyramid("TileMesh.depthPyramid")
+		, m_viewProjection(1.f)
+		, m_depthPyramidViewProjection(1.f)
+		, m_cullAllocator("TileMesh.cullBuffers")
+		, m_culledInstancesBuffer(m_cullAllocator, GL_SHADER_STORAGE_BUFFER)
+		, m_culledCommandsBuffer(m_cullAllocator, GL_SHADER_STORAGE_BUFFER)
+		, m_cullCountersBuffer(m_cullAllocator, GL_SHADER_STORAGE_BUFFER)
+		, m_culledMergedTopsBuffer(m_cullAllocator, GL_SHADER_STORAGE_BUFFER)
+		, m_uploadingAsync(false)
 	{
+		m_perFrameDataBuffer.setName("TileMesh.perFrameData");
+		m_indicesBuffer.setName("TileMesh.indices");
+		m_tileTemplatesBuffer.setName("TileMesh.tileTemplates");
+		m_tileVerticesBuffer.setName("TileMesh.tileVertices");
+		m_tilesBuffer.setName("TileMesh.tiles");
+		m_indirectCommandsBuffer.setName("TileMesh.indirectCommands");
+
+		// no vertex attributes, the vertices are pulled from the tile vertices of each template by gl_VertexID
+		glCreateVertexArrays(1, &m_vao);
+		glVertexArrayElementBuffer(m_vao, m_indicesBuffer.getHandle());
+
+		m_tileProgram.load("shaders/tile.frag", "shaders/tile.vert");
+
+		m_clustersBuffer.setName("TileMesh.clusters");
+		m_clusterTilesBuffer.setName("TileMesh.clusterTiles");
+		m_clusterOrderBuffer.setName("TileMesh.clusterOrder");
+		m_drawGroupsBuffer.setName("TileMesh.drawGroups");
+		m_mergedTopsBuffer.setName("TileMesh.mergedTops");
+
+		m_cullProgram.loadCompute("shaders/tilecull.comp");
+		m_compactProgram.loadCompute("shaders/tilecompact.comp");
+
+		updateCullBounds();
+
+		const TileIndexRange& topIndexRange = tileFaceMaskIndexRanges[TileFaceMask_Top];
+		glProgramUniform2ui(m_compactProgram.getProgramId(), 1, topIndexRange.firstIndex, topIndexRange.count);
+
+		m_mergedTopProgram.load("shaders/tilemerged.frag", "shaders/tilemerged.vert");
+	}
+
+	~TileMesh()
+	{
+		for (const auto& [firstTileIndex, fence] : m_releasedTileBlocks)
+		{
+			glDeleteSync(fence);
+		}
+		glDeleteVertexArrays(1, &m_vao);
+	}
+
+	void setPerFrameData(const PerFrameData& perFrameData)
+	{
+		m_perFrameDataBuffer.update(perFrameData);
+		m_viewProjection = perFrameData.projection * perFrameData.view;
+		// the vertical axis is not affected by the camera rotation
+		m_zoom = glm::length(glm::vec3(perFrameData.view[2])) / glm::length(axes[2]);
+	}
+
+	// at or below this zoom, 1 being the initial camera zoom, the merged tops replace the tops of the tiles they cover
+	void setMergeTopsMaxZoom(float maxZoom)
+	{
+		m_mergeTopsMaxZoom = maxZoom;
+	}
+
+	// enables or disables merging the tops for the clusters overlapping the given range of tile cells
+	void setMergeTops(const glm::ivec2& cellMin, const glm::ivec2& cellMax, bool mergeTops)
+	{
+		for (size_t clusterIndex = 0; clusterIndex < m_clusterCells.size(); ++clusterIndex)
+		{
+			const glm::ivec2 clusterCellMin = m_clusterCells[clusterIndex] * ClusterSize;
+			const glm::ivec2 clusterCellMax = clusterCellMin + (ClusterSize - 1);
+			if (glm::all(glm::lessThanEqual(cellMin, clusterCellMax)) && glm::all(glm::lessThanEqual(clusterCellMin, cellMax))
+				&& m_clusterMergeTops[clusterIndex] != mergeTops)
+			{
+				m_clusterMergeTops[clusterIndex] = mergeTops;
+				markMergedTopsDirty(static_cast<GLuint>(clusterIndex));
+			}
+		}
+	}
+
+	// rotation of the camera around the z axis, tiles are drawn front to back for its quadrant
+	void setViewRotation(float rotation)
+	{
+		m_viewRotation = rotation;
+	}
+
+	// tiles hidden behind the opaque tiles drawn in the previous frame are culled, the visibility of the tiles
+	// revealed by a camera move or a tile change only catches up one frame later
+	void setOcclusionCulling(bool occlusionCulling)
+	{
+		m_occlusionCulling = occlusionCulling;
+		if (!occlusionCulling)
+		{
+			m_depthPyramid.invalidate();
+		}
+	}
+
+	int addTileTemplate(const TileTemplate& tileTemplate)
+	{
+		int index = static_cast<int>(m_tileTemplates.size());
+		assert(tileTemplate.getNumVariants() <= (1u << TileDataVariantBits));
+		m_tileTemplates.push_back(tileTemplate);
+
+		TileTemplateData tileTemplateData;
+		tileTemplateData.albedoTexture = tileTemplate.getTexture().getHandleBindless();
+		tileTemplateData.numVariants = tileTemplate.getNumVariants();
+		tileTemplateData.numAnimationFrames = tileTemplate.getNumAnimationFrames();
+		if (tileTemplate.isTranslucent())
+		{
+			tileTemplateData.flags |= TileTemplateFlag_Translucent;
+			m_hasTranslucentTemplates = true;
+		}
+
+		m_tileTemplatesBuffer.addObject(tileTemplateData);
+
+		// the shape of the tiles depends on the sprite size of their template
 		const glm::ivec2& spriteSize = tileTemplate.getTexture().getSize();
 		const float spriteWidth = static_cast<float>(spriteSize.x);
 		const float spriteHeight = static_cast<float>(spriteSize.y);
@@ -87,130 +384,1293 @@ public:
 		const glm::vec2 uv5(uv2.x, localMaxV + axes[0].y / spriteHeight);
 		const glm::vec2 uv6(uv3.x, localMaxV);
 
-		const TileVertex tileVertices[] = {
+		const TileVertex tileVertices[TileVertexCount] = {
 			// tile top with upwards normals
-			{ glm::vec3(-0.5f, -0.5f,    0.f),  glm::vec3(0.f, 0.f, 1.f), uv0 },
-			{ glm::vec3(0.5f,  -0.5f,    0.f),  glm::vec3(0.f, 0.f, 1.f), uv1 },
-			{ glm::vec3(-0.5f,  0.5f,    0.f),  glm::vec3(0.f, 0.f, 1.f), uv2 },
-			{ glm::vec3(0.5f,   0.5f,    0.f),  glm::vec3(0.f, 0.f, 1.f), uv3 },
+			{ glm::vec4(-0.5f, -0.5f,    0.f, 1.f),  glm::vec4(0.f, 0.f, 1.f, 0.f), uv0 },
+			{ glm::vec4(0.5f,  -0.5f,    0.f, 1.f),  glm::vec4(0.f, 0.f, 1.f, 0.f), uv1 },
+			{ glm::vec4(-0.5f,  0.5f,    0.f, 1.f),  glm::vec4(0.f, 0.f, 1.f, 0.f), uv2 },
+			{ glm::vec4(0.5f,   0.5f,    0.f, 1.f),  glm::vec4(0.f, 0.f, 1.f, 0.f), uv3 },
 
 			// tile left side with sideways normals
-			{ glm::vec3(0.5f,  -0.5f,     0.f), glm::vec3(1.f, 0.f, 0.f), uv1 },
-			{ glm::vec3(0.5f,   0.5f,     0.f), glm::vec3(1.f, 0.f, 0.f), uv3 },
-			{ glm::vec3(0.5f,  -0.5f, bottomZ), glm::vec3(1.f, 0.f, 0.f), uv4 },
-			{ glm::vec3(0.5f,   0.5f, bottomZ), glm::vec3(1.f, 0.f, 0.f), uv6 },
+			{ glm::vec4(0.5f,  -0.5f,     0.f, 1.f), glm::vec4(1.f, 0.f, 0.f, 0.f), uv1 },
+			{ glm::vec4(0.5f,   0.5f,     0.f, 1.f), glm::vec4(1.f, 0.f, 0.f, 0.f), uv3 },
+			{ glm::vec4(0.5f,  -0.5f, bottomZ, 1.f), glm::vec4(1.f, 0.f, 0.f, 0.f), uv4 },
+			{ glm::vec4(0.5f,   0.5f, bottomZ, 1.f), glm::vec4(1.f, 0.f, 0.f, 0.f), uv6 },
 
 			// tile right side with sideways normals
-			{ glm::vec3(-0.5f,  0.5f,     0.f), glm::vec3(0.f, 1.f, 0.f), uv2 },
-			{ glm::vec3(0.5f,   0.5f,     0.f), glm::vec3(0.f, 1.f, 0.f), uv3 },
-			{ glm::vec3(-0.5f,  0.5f, bottomZ), glm::vec3(0.f, 1.f, 0.f), uv5 },
-			{ glm::vec3(0.5f,   0.5f, bottomZ), glm::vec3(0.f, 1.f, 0.f), uv6 },
+			{ glm::vec4(-0.5f,  0.5f,     0.f, 1.f), glm::vec4(0.f, 1.f, 0.f, 0.f), uv2 },
+			{ glm::vec4(0.5f,   0.5f,     0.f, 1.f), glm::vec4(0.f, 1.f, 0.f, 0.f), uv3 },
+			{ glm::vec4(-0.5f,  0.5f, bottomZ, 1.f), glm::vec4(0.f, 1.f, 0.f, 0.f), uv5 },
+			{ glm::vec4(0.5f,   0.5f, bottomZ, 1.f), glm::vec4(0.f, 1.f, 0.f, 0.f), uv6 },
 		};
+		for (const TileVertex& tileVertex : tileVertices)
+		{
+			m_tileVerticesBuffer.addObject(tileVertex);
+		}
 
-		m_verticesBuffer.update(tileVertices, sizeof(tileVertices));
+		// the draw groups of the template pull its vertices from the shared tile vertices through their base vertex
+		const GLuint geometryIndex = addGeometry(
+			sizeof(tileIndices) / sizeof(GLuint), // number of vertices
+			0, // index offset
+			static_cast<GLuint>(index) * TileVertexCount // vertex offset
+		);
+		assert(geometryIndex == static_cast<GLuint>(index));
 
-		glCreateVertexArrays(1, &m_vao);
-		glVertexArrayElementBuffer(m_vao, m_indicesBuffer.getHandle());
-		glVertexArrayVertexBuffer(m_vao, 0, m_verticesBuffer.getHandle(), 0, sizeof(TileVertex));
-		// position
-		glEnableVertexArrayAttrib(m_vao, 0);
-		glVertexArrayAttribFormat(m_vao, 0, 3, GL_FLOAT, GL_FALSE, offsetof(TileVertex, position));
-		glVertexArrayAttribBinding(m_vao, 0, 0);
-		// normal
-		glEnableVertexArrayAttrib(m_vao, 1);
-		glVertexArrayAttribFormat(m_vao, 1, 3, GL_FLOAT, GL_FALSE, offsetof(TileVertex, normal));
-		glVertexArrayAttribBinding(m_vao, 1, 0);
-		// uv
-		glEnableVertexArrayAttrib(m_vao, 2);
-		glVertexArrayAttribFormat(m_vao, 2, 2, GL_FLOAT, GL_FALSE, offsetof(TileVertex, uv));
-		glVertexArrayAttribBinding(m_vao, 2, 0);
+		m_tileTemplateHeights.push_back(tileHeight3d);
+		if (bottomZ < m_tileBoundsMin.z)
+		{
+			m_tileBoundsMin.z = bottomZ;
+			updateCullBounds();
+		}
 
-		m_tileProgram.load("shaders/tile.frag", "shaders/tile.vert");
+		return index;
 	}
 
-	~TileMesh()
+	// tiles are snapped to the center of their cell and their height is quantized
+	int addTile(const glm::vec3& position, int tileTemplateIndex)
 	{
-		glDeleteVertexArrays(1, &m_vao);
+		return addTiles(1, [&position, tileTemplateIndex](size_t)
+		{
+			return TilePlacement{ position, tileTemplateIndex };
+		});
 	}
 
-	void setPerFrameData(const PerFrameData& perFrameData)
+	// adds tileCount tiles at once on worker threads, getTile(i) returns the i-th tile and is called concurrently,
+	// returns the index of the first tile
+	template <class GetTile>
+	int addTiles(size_t tileCount, GetTile getTile)
 	{
-		m_perFrameDataBuffer.update(perFrameData);
+		const GLuint firstTileIndex = addTileSlots(tileCount);
+		m_placedRanges.clear();
+		for (size_t first = 0; first < tileCount; first += MaxTilesPerCommand)
+		{
+			m_placedRanges.push_back({ firstTileIndex + static_cast<GLuint>(first), static_cast<GLuint>(std::min<size_t>(MaxTilesPerCommand, tileCount - first)) });
+		}
+		placeTiles(m_placedRanges, getTile);
+		return static_cast<int>(firstTileIndex);
 	}
 
-	int addTileTemplate(const TileTemplate& tileTemplate)
+	// tile slots are handed out to the chunks of a map in blocks, the released blocks are reused once the GPU is done
+	// with the commands that may still read their tiles
+	GLuint allocateTileBlock()
 	{
-		int index = static_cast<int>(m_tileTemplates.size());
-		m_tileTemplates.push_back(tileTemplate);
+		if (!m_releasedTileBlocks.empty())
+		{
+			const auto [firstTileIndex, fence] = m_releasedTileBlocks.front();
+			const GLenum result = glClientWaitSync(fence, 0, 0);
+			assert(result != GL_WAIT_FAILED);
+			if (result != GL_TIMEOUT_EXPIRED)
+			{
+				glDeleteSync(fence);
+				m_releasedTileBlocks.pop_front();
+				return firstTileIndex;
+			}
+		}
+		return addTileSlots(TileBlockSize);
+	}
 
-		TileTemplateData tileTemplateData;
-		tileTemplateData.albedoTexture = tileTemplate.getTexture().getHandleBindless();
-		tileTemplateData.numVariants = tileTemplate.getNumVariants();
-		tileTemplateData.numAnimationFrames = tileTemplate.getNumAnimationFrames();
+	// number of clusters the tiles placed in the slots belong to
+	size_t getClusterCount(const std::vector<TileSlotRange>& ranges) const
+	{
+		std::vector<GLuint> clusters;
+		for (const TileSlotRange& slots : ranges)
+		{
+			for (GLuint tileIndex = slots.firstTileIndex; tileIndex < slots.firstTileIndex + slots.count; ++tileIndex)
+			{
+				assert(m_tileClusters[tileIndex] != InvalidClusterIndex);
+				clusters.push_back(m_tileClusters[tileIndex]);
+			}
+		}
+		std::sort(clusters.begin(), clusters.end());
+		return static_cast<size_t>(std::unique(clusters.begin(), clusters.end()) - clusters.begin());
+	}
 
-		m_tileTemplatesBuffer.addObject(tileTemplateData);
+	// the tiles of the block must have been removed, the fence follows the commands issued so far
+	void releaseTileBlock(GLuint firstTileIndex)
+	{
+		assert(firstTileIndex % TileBlockSize == 0);
+		m_releasedTileBlocks.emplace_back(firstTileIndex, glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0));
+	}
 
-		return index;
+	// places tiles in free slots, getTile(i) returns the i-th tile over all the ranges and is called concurrently
+	// the tiles of all the ranges are split evenly between worker threads, each thread finds the range of its first
+	// tile in the prefix sum of the sizes of the ranges and counts the tiles of each draw group on its own
+	template <class GetTile>
+	void placeTiles(const std::vector<TileSlotRange>& ranges, GetTile getTile)
+	{
+		m_rangeFirstTiles.resize(ranges.size() + 1);
+		m_rangeFirstTiles[0] = 0;
+		for (size_t range = 0; range < ranges.size(); ++range)
+		{
+			m_rangeFirstTiles[range + 1] = m_rangeFirstTiles[range] + ranges[range].count;
+		}
+		const size_t tileCount = m_rangeFirstTiles.back();
+		if (tileCount == 0)
+		{
+			return;
+		}
+		const bool hadTiles = !m_cellFirstTile.empty();
+
+		// func(thread, range, i) for the i-th tile of each range
+		const unsigned int threadCount = m_workerThreads.getThreadCount(tileCount, MinTilesPerThread);
+		auto forEachTile = [this, &ranges, tileCount, threadCount](auto func)
+		{
+			m_workerThreads.run(threadCount, [&](unsigned int thread)
+			{
+				const auto [firstTile, lastTile] = WorkerThreads::getThreadRange(tileCount, threadCount, thread);
+				size_t range = static_cast<size_t>(std::upper_bound(m_rangeFirstTiles.begin(), m_rangeFirstTiles.end(), firstTile) - m_rangeFirstTiles.begin()) - 1;
+				for (size_t tile = firstTile; tile < lastTile; ++tile)
+				{
+					while (tile >= m_rangeFirstTiles[range + 1])
+					{
+						++range;
+					}
+					func(thread, range, static_cast<GLuint>(tile - m_rangeFirstTiles[range]));
+				}
+			});
+		};
+
+		// tile positions and templates, the variants are drawn from a generator per thread
+		const unsigned int seed = static_cast<unsigned int>(rand());
+		m_threadRandoms.resize(threadCount);
+		for (unsigned int thread = 0; thread < threadCount; ++thread)
+		{
+			m_threadRandoms[thread].seed(seed + thread);
+		}
+		forEachTile([&](unsigned int thread, size_t range, GLuint i)
+		{
+			std::uniform_real_distribution<float> distribution(0.f, 1.f);
+			const GLuint tileIndex = ranges[range].firstTileIndex + i;
+			assert(m_tileDrawGroups[tileIndex] == InvalidDrawGroup);
+			const TilePlacement tile = getTile(m_rangeFirstTiles[range] + i);
+			const glm::vec3 tilePosition = snapTilePosition(tile.position);
+			m_tilePositions[tileIndex] = tilePosition;
+			m_tileTemplateIndices[tileIndex] = static_cast<GLuint>(tile.tileTemplateIndex);
+			m_tileVariantIndices[tileIndex] = static_cast<GLuint>(m_tileTemplates[tile.tileTemplateIndex].getTileVariantIndex(distribution(m_threadRandoms[thread])));
+		});
+
+		// the map of the cells and the clusters are shared between all the tiles
+		m_rangeTiles.resize(ranges.size());
+		for (size_t range = 0; range < ranges.size(); ++range)
+		{
+			const TileSlotRange& slots = ranges[range];
+			m_rangeTiles[range] = m_tilesBuffer.editObjects(slots.firstTileIndex, slots.count);
+			for (GLuint tileIndex = slots.firstTileIndex; tileIndex < slots.firstTileIndex + slots.count; ++tileIndex)
+			{
+				m_tileTopsMerged[tileIndex] = false;
+				addTileToCluster(tileIndex, m_tilePositions[tileIndex]);
+				linkTileToCell(tileIndex);
+			}
+		}
+
+		// face masks once all the neighbours are known, each thread counts the tiles of every draw group
+		const size_t groupCount = m_drawGroups.size();
+		m_threadGroupCounts.assign(threadCount * groupCount, 0);
+		forEachTile([&](unsigned int thread, size_t range, GLuint i)
+		{
+			const GLuint tileIndex = ranges[range].firstTileIndex + i;
+			const GLuint faceMask = computeTileFaceMask(tileIndex);
+			const GLuint tileTemplateIndex = m_tileTemplateIndices[tileIndex];
+			const GLuint groupIndex = getDrawGroup(tileTemplateIndex, faceMask);
+			m_tileDrawGroups[tileIndex] = groupIndex;
+			++m_threadGroupCounts[thread * groupCount + groupIndex];
+			m_rangeTiles[range][i] = makeTileData(tileIndex);
+		});
+		for (unsigned int thread = 0; thread < threadCount; ++thread)
+		{
+			for (size_t groupIndex = 0; groupIndex < groupCount; ++groupIndex)
+			{
+				m_drawGroups[groupIndex].instanceCount += m_threadGroupCounts[thread * groupCount + groupIndex];
+			}
+		}
+		m_drawGroupsDirty = true;
+
+		// the tiles placed before may have faces hidden by the new ones, the masks of the new ones stay the same
+		if (hadTiles)
+		{
+			for (const TileSlotRange& slots : ranges)
+			{
+				for (GLuint tileIndex = slots.firstTileIndex; tileIndex < slots.firstTileIndex + slots.count; ++tileIndex)
+				{
+					updateFaceMasksAround(getTileCell(m_tilePositions[tileIndex]));
+				}
+			}
+		}
 	}
 
-	void addTile(const glm::vec3& tilePosition, int tileTemplateIndex)
+	// the slots of the removed tiles are free to place other tiles, the clusters left without tiles are reused,
+	// the frames in flight still walk the removed tiles and skip them by their empty face mask
+	void removeTiles(const std::vector<TileSlotRange>& ranges)
 	{
-		const GLuint baseInstance = static_cast<GLuint>(m_tilesBuffer.getObjectCount());
-		const TileTemplate& tileTemplate = m_tileTemplates[tileTemplateIndex];
-		int tileVariantIndex = tileTemplate.getRandomTileVariantIndex();
-		TileData tileData;
-		tileData.position = glm::vec4(tilePosition, 1.f);
-		tileData.tileTemplateIndex = tileTemplateIndex;
-		tileData.tileVariantIndex = tileTemplate.getRandomTileVariantIndex();
-		m_tilesBuffer.addObject(tileData);
-		m_indirectCommandsBuffer.addCommand(
-			sizeof(tileIndices) / sizeof(GLuint), // number of vertices
-			1, // number of instances to draw
-			0, // index offset
-			0, // vertex offset
-			baseInstance
+		for (const TileSlotRange& slots : ranges)
+		{
+			for (GLuint tileIndex = slots.firstTileIndex; tileIndex < slots.firstTileIndex + slots.count; ++tileIndex)
+			{
+				assert(m_tileDrawGroups[tileIndex] != InvalidDrawGroup);
+				removeTileFromCell(tileIndex);
+				removeTileFromCluster(tileIndex);
+				setTileTopMerged(tileIndex, false);
+				--m_drawGroups[m_tileDrawGroups[tileIndex]].instanceCount;
+				m_tileDrawGroups[tileIndex] = InvalidDrawGroup;
+				m_tilesBuffer.setObject(tileIndex, packTileData(glm::ivec2(0), 0.f, 0, 0, TileFaceMask_None));
+			}
+		}
+		m_drawGroupsDirty = true;
+	}
+
+	// tiles are laid out on a unit grid, stacked tiles share a cell
+	static glm::ivec2 getTileCell(const glm::vec3& tilePosition)
+	{
+		return glm::ivec2(
+			static_cast<int>(std::floor(tilePosition.x + 0.5f)),
+			static_cast<int>(std::floor(tilePosition.y + 0.5f))
 		);
 	}
 
+	// a tile keeps its cluster when moved, the cluster bounds only grow
+	void setTile(int tileIndex, const glm::vec3& position, int tileTemplateIndex)
+	{
+		assert(m_tileDrawGroups[tileIndex] != InvalidDrawGroup);
+		const glm::vec3 tilePosition = snapTilePosition(position);
+		if (m_tileTemplateIndices[tileIndex] != static_cast<GLuint>(tileTemplateIndex))
+		{
+			setTileDrawGroup(tileIndex, getDrawGroup(static_cast<GLuint>(tileTemplateIndex), getTileFaceMask(tileIndex)));
+		}
+		m_tileTemplateIndices[tileIndex] = tileTemplateIndex;
+		m_tileVariantIndices[tileIndex] = static_cast<GLuint>(m_tileTemplates[tileTemplateIndex].getRandomTileVariantIndex());
+		setTileTopMerged(tileIndex, false);
+		growCluster(m_tileClusters[tileIndex], tilePosition);
+		removeTileFromCell(tileIndex);
+		addTileToCell(tileIndex, tilePosition);
+		m_tilesBuffer.setObject(tileIndex, makeTileData(tileIndex));
+		markMergedTopsDirty(m_tileClusters[tileIndex]);
+	}
+
+	// only sends the changes since the last upload
 	void upload()
 	{
-		std::cout << "Uploading " << m_tilesBuffer.getObjectCount() << " tiles" << std::endl;
+		bakeMergedTops();
 		m_tilesBuffer.upload();
 		m_tileTemplatesBuffer.upload();
+		m_tileVerticesBuffer.upload();
 		m_indirectCommandsBuffer.upload();
+		m_clustersBuffer.upload();
+		m_clusterTilesBuffer.upload();
+		m_mergedTopsBuffer.upload();
+	}
+
+	// streams the new commands over the next frames, tiles are drawn as soon as their command is resident, the
+	// tiles, clusters and merged tops refer to each other and go along with the draw group counts uploaded by the
+	// next draw, streaming them would let the culling walk cluster lists that don't match the counts
+	void upload(GLUploadQueue& uploadQueue)
+	{
+		bakeMergedTops();
+		m_tileTemplatesBuffer.upload();
+		m_tileVerticesBuffer.upload();
+		m_tilesBuffer.upload();
+		m_clustersBuffer.upload();
+		m_clusterTilesBuffer.upload();
+		m_mergedTopsBuffer.upload();
+		m_indirectCommandsBuffer.upload(uploadQueue);
+	}
+
+	// builds and uploads the tiles on the loader thread, the mesh is not drawn until the upload is published back
+	void uploadAsync(GLLoaderThread& loaderThread, std::function<void(TileMesh&)> build = nullptr)
+	{
+		assert(!m_uploadingAsync);
+		m_uploadingAsync = true;
+		loaderThread.post(
+			[this, build = std::move(build)]()
+			{
+				if (build)
+				{
+					build(*this);
+				}
+				std::cout << "Uploading " << m_tilesBuffer.getObjectCount() << " tiles" << std::endl;
+				upload();
+			},
+			[this]()
+			{
+				m_uploadingAsync = false;
+			}
+		);
+	}
+
+	// bytes sent to the GPU by the last call to upload()
+	GLsizeiptr getLastUploadBytes() const
+	{
+		return m_tilesBuffer.getLastUploadBytes()
+			+ m_tileTemplatesBuffer.getLastUploadBytes()
+			+ m_tileVerticesBuffer.getLastUploadBytes()
+			+ m_indirectCommandsBuffer.getLastUploadBytes()
+			+ m_clustersBuffer.getLastUploadBytes()
+			+ m_clusterTilesBuffer.getLastUploadBytes()
+			+ m_mergedTopsBuffer.getLastUploadBytes();
 	}
 
 	void draw()
 	{
+		if (m_uploadingAsync)
+		{
+			return;
+		}
+
+		const GLsizei drawCount = getResidentDrawCount();
+		if (drawCount == 0)
+		{
+			return;
+		}
+
+		cull(drawCount);
+
 		m_tileProgram.use();
 
 		glBindVertexArray(m_vao);
 		m_perFrameDataBuffer.bind(GL_UNIFORM_BUFFER, PerFrameBufferIndex);
 		m_tilesBuffer.bind(GL_SHADER_STORAGE_BUFFER, TilesBufferIndex);
 		m_tileTemplatesBuffer.bind(GL_SHADER_STORAGE_BUFFER, TileTemplatesBufferIndex);
-		m_indirectCommandsBuffer.draw();
+		m_tileVerticesBuffer.bind(GL_SHADER_STORAGE_BUFFER, TileVerticesBufferIndex);
+		m_culledInstancesBuffer.bind(GL_SHADER_STORAGE_BUFFER, InstancesBufferIndex);
+
+		// opaque pass without blending, the cutout edges are alpha tested
+		const GLsizei groupCount = static_cast<GLsizei>(m_drawGroups.size());
+		glDisable(GL_BLEND);
+		glProgramUniform1i(m_tileProgram.getProgramId(), AlphaTestUniformLocation, GL_TRUE);
+		GLIndirectCommandsBuffer<MaxCommands>::drawIndirectCount(
+			m_culledCommandsBuffer.getBuffer(), m_culledCommandsBuffer.getOffset(),
+			m_cullCountersBuffer.getBuffer(), m_cullCountersBuffer.getOffset(),
+			groupCount
+		);
+
+		// opaque merged tops, after all the groups of both passes
+		if (isMergingTops())
+		{
+			m_mergedTopProgram.use();
+			m_mergedTopsBuffer.bind(GL_SHADER_STORAGE_BUFFER, MergedTopsBufferIndex);
+			m_culledMergedTopsBuffer.bind(GL_SHADER_STORAGE_BUFFER, MergedTopInstancesBufferIndex);
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_culledCommandsBuffer.getHandle());
+			glDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, reinterpret_cast<const void*>(m_culledCommandsBuffer.getOffset() + 2 * groupCount * sizeof(DrawElementsIndirectCommand)));
+			m_tileProgram.use();
+		}
+
+		// the depth of the opaque tiles hides the tiles behind them in the next frame
+		if (m_occlusionCulling)
+		{
+			updateDepthPyramid();
+			m_tileProgram.use();
+		}
+
+		// blended pass over the opaque tiles, without writing depth
+		if (m_hasTranslucentTemplates)
+		{
+			glEnable(GL_BLEND);
+			glDepthMask(GL_FALSE);
+			glProgramUniform1i(m_tileProgram.getProgramId(), AlphaTestUniformLocation, GL_FALSE);
+			GLIndirectCommandsBuffer<MaxCommands>::drawIndirectCount(
+				m_culledCommandsBuffer.getBuffer(), m_culledCommandsBuffer.getOffset() + groupCount * sizeof(DrawElementsIndirectCommand),
+				m_cullCountersBuffer.getBuffer(), m_cullCountersBuffer.getOffset() + sizeof(GLuint),
+				groupCount
+			);
+			glDepthMask(GL_TRUE);
+			glDisable(GL_BLEND);
+		}
 		glBindVertexArray(0);
 
 		glUseProgram(0);
 	}
 
+protected:
+	// merged tops owned by a cluster, the first ones being baked, the capacity is a power of two up to MaxMergedTopsPerCluster
+	struct MergedTopRange
+	{
+		GLuint first;
+		GLuint capacity;
+	};
+	static constexpr int MergedTopRangeClassCount = 6;
+	static_assert(1u << (MergedTopRangeClassCount - 1) == MaxMergedTopsPerCluster);
+
+	// commands are sorted by base instance, only those whose tiles all are resident can be drawn
+	GLsizei getResidentDrawCount() const
+	{
+		const size_t residentTiles = m_tilesBuffer.getResidentCount();
+		const size_t residentCommands = m_indirectCommandsBuffer.getResidentCount();
+		size_t drawCount = 0;
+		while (drawCount < residentCommands)
+		{
+			const DrawElementsIndirectCommand& command = m_indirectCommandsBuffer.getObject(drawCount);
+			if (command.baseInstance + command.instanceCount > residentTiles)
+			{
+				break;
+			}
+			++drawCount;
+		}
+		return static_cast<GLsizei>(drawCount);
+	}
+
+	// appends free tile slots, the commands only track the slot ranges to cull whatever the templates of their tiles
+	GLuint addTileSlots(size_t count)
+	{
+		const GLuint firstTileIndex = static_cast<GLuint>(m_tilesBuffer.getObjectCount());
+		const size_t tileEnd = firstTileIndex + count;
+		m_tilesBuffer.addObjects(count);
+		m_indirectCommandsBuffer.addInstances(sizeof(tileIndices) / sizeof(GLuint), 0, 0, firstTileIndex, static_cast<GLuint>(count), MaxTilesPerCommand);
+		m_tilePositions.resize(tileEnd);
+		m_nextTileInCell.resize(tileEnd, InvalidTileIndex);
+		m_tileDrawGroups.resize(tileEnd, InvalidDrawGroup);
+		m_tileTemplateIndices.resize(tileEnd);
+		m_tileVariantIndices.resize(tileEnd);
+		m_tileTopsMerged.resize(tileEnd, false);
+		m_tileClusters.resize(tileEnd, InvalidClusterIndex);
+		return firstTileIndex;
+	}
+
+	// the geometry of a template has the same index as the template
+	static GLuint getDrawGroup(GLuint tileTemplateIndex, GLuint faceMask)
+	{
+		return tileTemplateIndex * TileFaceMask_Count + faceMask;
+	}
+
+	void setTileDrawGroup(GLuint tileIndex, GLuint groupIndex)
+	{
+		const GLuint previousGroupIndex = m_tileDrawGroups[tileIndex];
+		if (groupIndex == previousGroupIndex)
+		{
+			return;
+		}
+		--m_drawGroups[previousGroupIndex].instanceCount;
+		++m_drawGroups[groupIndex].instanceCount;
+		if (m_tileTopsMerged[tileIndex])
+		{
+			--m_drawGroupMergedTopCounts[previousGroupIndex];
+			++m_drawGroupMergedTopCounts[groupIndex];
+		}
+		m_tileDrawGroups[tileIndex] = groupIndex;
+		m_drawGroupsDirty = true;
+	}
+
+	// the cull shader draws the tiles whose top is merged in the group of their other faces
+	void setTileTopMerged(GLuint tileIndex, bool topMerged)
+	{
+		if (m_tileTopsMerged[tileIndex] == topMerged)
+		{
+			return;
+		}
+		if (topMerged)
+		{
+			++m_drawGroupMergedTopCounts[m_tileDrawGroups[tileIndex]];
+		}
+		else
+		{
+			--m_drawGroupMergedTopCounts[m_tileDrawGroups[tileIndex]];
+		}
+		m_tileTopsMerged[tileIndex] = topMerged;
+		m_drawGroupsDirty = true;
+	}
+
+	// a geometry has a draw group for each face mask, drawing part of its indices
+	GLuint addGeometry(GLuint count, GLuint firstIndex, GLuint baseVertex)
+	{
+		DrawElementsIndirectCommand& geometry = m_geometries.emplace_back();
+		assert(m_geometries.size() <= MaxGeometries);
+		geometry.count = count;
+		geometry.instanceCount = 0;
+		geometry.firstIndex = firstIndex;
+		geometry.baseVertex = baseVertex;
+		geometry.baseInstance = 0;
+
+		for (const TileIndexRange& indexRange : tileFaceMaskIndexRanges)
+		{
+			DrawElementsIndirectCommand& drawGroup = m_drawGroups.emplace_back(geometry);
+			drawGroup.count = indexRange.count;
+			drawGroup.firstIndex = firstIndex + indexRange.firstIndex;
+			m_drawGroupMergedTopCounts.push_back(0);
+		}
+		m_drawGroupsDirty = true;
+
+		return static_cast<GLuint>(m_geometries.size() - 1);
+	}
+
+	GLuint getTileFaceMask(GLuint tileIndex) const
+	{
+		return m_tileDrawGroups[tileIndex] % TileFaceMask_Count;
+	}
+
+	static glm::vec3 snapTilePosition(const glm::vec3& tilePosition)
+	{
+		const glm::ivec2 cell = getTileCell(tilePosition);
+		return glm::vec3(static_cast<float>(cell.x), static_cast<float>(cell.y), quantizeTileHeight(tilePosition.z));
+	}
+
+	// shifted as unsigned, negative coordinates are common and shifting them as signed is undefined
+	static std::int64_t getCellKey(std::int64_t x, std::int64_t y)
+	{
+		return static_cast<std::int64_t>((static_cast<std::uint64_t>(x) << 32) ^ (static_cast<std::uint64_t>(y) & 0xFFFFFFFF));
+	}
+
+	void addTileToCell(GLuint tileIndex, const glm::vec3& tilePosition)
+	{
+		if (tileIndex == m_tilePositions.size())
+		{
+			m_tilePositions.push_back(tilePosition);
+			m_nextTileInCell.push_back(InvalidTileIndex);
+		}
+		m_tilePositions[tileIndex] = tilePosition;
+		linkTileToCell(tileIndex);
+		updateFaceMasksAround(getTileCell(tilePosition));
+	}
+
+	// puts the tile first in the list of the cell of its position
+	void linkTileToCell(GLuint tileIndex)
+	{
+		const glm::ivec2 cell = getTileCell(m_tilePositions[tileIndex]);
+		auto [it, inserted] = m_cellFirstTile.try_emplace(getCellKey(cell.x, cell.y), tileIndex);
+		m_nextTileInCell[tileIndex] = inserted ? InvalidTileIndex : it->second;
+		it->second = tileIndex;
+	}
+
+	void removeTileFromCell(GLuint tileIndex)
+	{
+		const glm::ivec2 cell = getTileCell(m_tilePositions[tileIndex]);
+		auto it = m_cellFirstTile.find(getCellKey(cell.x, cell.y));
+		assert(it != m_cellFirstTile.end());
+		if (it->second == tileIndex)
+		{
+			if (m_nextTileInCell[tileIndex] == InvalidTileIndex)
+			{
+				m_cellFirstTile.erase(it);
+			}
+			else
+			{
+				it->second = m_nextTileInCell[tileIndex];
+			}
+		}
+		else
+		{
+			GLuint previousTileIndex = it->second;
+			while (m_nextTileInCell[previousTileIndex] != tileIndex)
+			{
+				previousTileIndex = m_nextTileInCell[previousTileIndex];
+				assert(previousTileIndex != InvalidTileIndex);
+			}
+			m_nextTileInCell[previousTileIndex] = m_nextTileInCell[tileIndex];
+		}
+		m_nextTileInCell[tileIndex] = InvalidTileIndex;
+
+		updateFaceMasksAround(cell);
+	}
+
+	// the tiles of a cell and those whose side faces look into it
+	void updateFaceMasksAround(const glm::ivec2& cell)
+	{
+		static const glm::ivec2 offsets[] = { glm::ivec2(0, 0), glm::ivec2(-1, 0), glm::ivec2(0, -1) };
+		for (const glm::ivec2& offset : offsets)
+		{
+			const glm::ivec2 neighbourCell = cell + offset;
+			auto it = m_cellFirstTile.find(getCellKey(neighbourCell.x, neighbourCell.y));
+			if (it == m_cellFirstTile.end())
+			{
+				continue;
+			}
+			for (GLuint tileIndex = it->second; tileIndex != InvalidTileIndex; tileIndex = m_nextTileInCell[tileIndex])
+			{
+				updateFaceMask(tileIndex);
+			}
+		}
+	}
+
+	void updateFaceMask(GLuint tileIndex)
+	{
+		const GLuint faceMask = computeTileFaceMask(tileIndex);
+		const GLuint previousGroupIndex = m_tileDrawGroups[tileIndex];
+		const GLuint groupIndex = previousGroupIndex - previousGroupIndex % TileFaceMask_Count + faceMask;
+		if (groupIndex == previousGroupIndex)
+		{
+			return;
+		}
+		setTileDrawGroup(tileIndex, groupIndex);
+		m_tilesBuffer.setObject(tileIndex, makeTileData(tileIndex));
+	}
+
+	// only reads the cells, the face masks of several tiles can be computed concurrently
+	GLuint computeTileFaceMask(GLuint tileIndex) const
+	{
+		const glm::ivec2 cell = getTileCell(m_tilePositions[tileIndex]);
+		GLuint faceMask = TileFaceMask_Top;
+		if (!isFaceCovered(tileIndex, cell + glm::ivec2(1, 0)))
+		{
+			faceMask |= TileFaceMask_Left;
+		}
+		if (!isFaceCovered(tileIndex, cell + glm::ivec2(0, 1)))
+		{
+			faceMask |= TileFaceMask_Right;
+		}
+		return faceMask;
+	}
+
+	// a side face is hidden when the tiles of the neighbouring cell cover its whole height
+	bool isFaceCovered(GLuint tileIndex, const glm::ivec2& neighbourCell) const
+	{
+		auto it = m_cellFirstTile.find(getCellKey(neighbourCell.x, neighbourCell.y));
+		if (it == m_cellFirstTile.end())
+		{
+			return false;
+		}
+
+		constexpr float epsilon = 0.001f;
+		const float top = m_tilePositions[tileIndex].z;
+		const float tileHeight = m_tileTemplateHeights[m_tileTemplateIndices[tileIndex]];
+		// lowest point not covered yet, grown from the bottom by the neighbours overlapping it
+		float coveredTo = top - tileHeight;
+		bool grown = true;
+		while (grown && coveredTo < top - epsilon)
+		{
+			grown = false;
+			for (GLuint neighbourIndex = it->second; neighbourIndex != InvalidTileIndex; neighbourIndex = m_nextTileInCell[neighbourIndex])
+			{
+				const float neighbourTop = m_tilePositions[neighbourIndex].z;
+				const float neighbourBottom = neighbourTop - m_tileTemplateHeights[m_tileTemplateIndices[neighbourIndex]];
+				if (neighbourBottom <= coveredTo + epsilon && neighbourTop > coveredTo + epsilon)
+				{
+					coveredTo = neighbourTop;
+					grown = true;
+				}
+			}
+		}
+		return coveredTo >= top - epsilon;
+	}
+
+	// bounds of the tiles of all the templates, relative to their position
+	void updateCullBounds()
+	{
+		glProgramUniform3fv(m_cullProgram.getProgramId(), 0, 1, &m_tileBoundsMin[0]);
+		glProgramUniform3fv(m_cullProgram.getProgramId(), 1, 1, &m_tileBoundsMax[0]);
+	}
+
+	// copies the depth of the current viewport of the bound framebuffer
+	void updateDepthPyramid()
+	{
+		GLint viewport[4];
+		glGetIntegerv(GL_VIEWPORT, viewport);
+		if (viewport[2] <= 0 || viewport[3] <= 0)
+		{
+			return;
+		}
+		assert(viewport[0] == 0 && viewport[1] == 0);
+		m_depthPyramid.update(glm::ivec2(viewport[2], viewport[3]));
+		m_depthPyramidViewProjection = m_viewProjection;
+	}
+
+	// merged tops are drawn once zoomed out enough
+	bool isMergingTops() const
+	{
+		return m_zoom <= m_mergeTopsMaxZoom && m_mergedTopsBuffer.getObjectCount() > 0;
+	}
+
+	// the tiles, cells or merging of the cluster changed since its merged tops were baked
+	void markMergedTopsDirty(GLuint clusterIndex)
+	{
+		if (!m_clusterMergedTopsDirty[clusterIndex])
+		{
+			m_clusterMergedTopsDirty[clusterIndex] = true;
+			m_dirtyMergedTopClusters.push_back(clusterIndex);
+		}
+	}
+
+	// greedily merges the runs of coplanar tops of the same opaque template into rectangles in the clusters marked dirty
+	void bakeMergedTops()
+	{
+		for (GLuint clusterIndex : m_dirtyMergedTopClusters)
+		{
+			bakeClusterMergedTops(clusterIndex);
+			m_clusterMergedTopsDirty[clusterIndex] = false;
+		}
+		m_dirtyMergedTopClusters.clear();
+	}
+
+	// smallest power of two holding the given number of merged tops, as its exponent
+	static int getMergedTopRangeClass(GLuint mergedTopCount)
+	{
+		int rangeClass = 0;
+		while ((1u << rangeClass) < mergedTopCount)
+		{
+			++rangeClass;
+		}
+		return rangeClass;
+	}
+
+	// the range of the cluster only moves when it is too small, an empty cluster gives its range back
+	const MergedTopRange& reserveMergedTops(GLuint clusterIndex, GLuint mergedTopCount)
+	{
+		MergedTopRange& range = m_clusterMergedTopRanges[clusterIndex];
+		if (mergedTopCount <= range.capacity && (mergedTopCount > 0 || range.capacity == 0))
+		{
+			return range;
+		}
+
+		if (range.capacity > 0)
+		{
+			m_freeMergedTopRanges[getMergedTopRangeClass(range.capacity)].push_back(range.first);
+			range = MergedTopRange{ 0, 0 };
+		}
+		if (mergedTopCount == 0)
+		{
+			return range;
+		}
+
+		const int rangeClass = getMergedTopRangeClass(mergedTopCount);
+		std::vector<GLuint>& freeRanges = m_freeMergedTopRanges[rangeClass];
+		range.capacity = 1u << rangeClass;
+		if (!freeRanges.empty())
+		{
+			range.first = freeRanges.back();
+			freeRanges.pop_back();
+		}
+		else
+		{
+			range.first = static_cast<GLuint>(m_mergedTopsBuffer.getObjectCount());
+			m_mergedTopsBuffer.addObjects(range.capacity);
+		}
+		return range;
+	}
+
+	void bakeClusterMergedTops(GLuint clusterIndex)
+	{
+		constexpr int NoSlot = -1;
+		constexpr float epsilon = 0.001f;
+
+		TileClusterData clusterData = m_clustersBuffer.getObject(clusterIndex);
+		const glm::ivec2 clusterCellOrigin = m_clusterCells[clusterIndex] * ClusterSize;
+
+		// slots of the cluster in each of its cells, stacked tiles are chained
+		std::array<int, MaxTilesPerCluster> cellFirstSlot;
+		std::array<int, MaxTilesPerCluster> nextSlotInCell;
+		std::array<bool, MaxTilesPerCluster> merged;
+		cellFirstSlot.fill(NoSlot);
+		merged.fill(false);
+		for (int slot = static_cast<int>(clusterData.tileCount) - 1; slot >= 0; --slot)
+		{
+			const GLuint tileIndex = getClusterTile(clusterIndex, slot);
+			const glm::ivec2 localCell = getTileCell(m_tilePositions[tileIndex]) - clusterCellOrigin;
+			// moved tiles may lie outside of their cluster
+			const bool canMerge = m_clusterMergeTops[clusterIndex]
+				&& glm::all(glm::greaterThanEqual(localCell, glm::ivec2(0)))
+				&& glm::all(glm::lessThan(localCell, glm::ivec2(ClusterSize)))
+				&& !m_tileTemplates[m_tileTemplateIndices[tileIndex]].isTranslucent();
+			if (canMerge)
+			{
+				const int cell = localCell.y * ClusterSize + localCell.x;
+				nextSlotInCell[slot] = cellFirstSlot[cell];
+				cellFirstSlot[cell] = slot;
+			}
+		}
+
+		// a slot of the cell not merged yet with the same template and height
+		auto findSlot = [&](int x, int y, GLuint tileTemplateIndex, float z)
+		{
+			for (int slot = cellFirstSlot[y * ClusterSize + x]; slot != NoSlot; slot = nextSlotInCell[slot])
+			{
+				const GLuint tileIndex = getClusterTile(clusterIndex, slot);
+				if (!merged[slot]
+					&& m_tileTemplateIndices[tileIndex] == tileTemplateIndex
+					&& std::abs(m_tilePositions[tileIndex].z - z) < epsilon)
+				{
+					return slot;
+				}
+			}
+			return NoSlot;
+		};
+
+		std::array<MergedTopData, MaxMergedTopsPerCluster> mergedTops;
+		GLuint mergedTopCount = 0;
+		std::array<bool, MaxTilesPerCluster> topsMerged;
+		topsMerged.fill(false);
+		std::array<int, MaxTilesPerCluster> rectangleSlots;
+		for (int y = 0; y < ClusterSize; ++y)
+		{
+			for (int x = 0; x < ClusterSize; ++x)
+			{
+				for (int slot = cellFirstSlot[y * ClusterSize + x]; slot != NoSlot; slot = nextSlotInCell[slot])
+				{
+					if (merged[slot])
+					{
+						continue;
+					}
+
+					const GLuint tileIndex = getClusterTile(clusterIndex, slot);
+					const GLuint tileTemplateIndex = m_tileTemplateIndices[tileIndex];
+					const float z = m_tilePositions[tileIndex].z;
+					int rectangleSlotCount = 0;
+					rectangleSlots[rectangleSlotCount++] = slot;
+					merged[slot] = true;
+
+					// grow along x, then add the rows that match over the whole width
+					int width = 1;
+					for (; x + width < ClusterSize; ++width)
+					{
+						const int otherSlot = findSlot(x + width, y, tileTemplateIndex, z);
+						if (otherSlot == NoSlot)
+						{
+							break;
+						}
+						rectangleSlots[rectangleSlotCount++] = otherSlot;
+						merged[otherSlot] = true;
+					}
+					int height = 1;
+					for (; y + height < ClusterSize; ++height)
+					{
+						std::array<int, ClusterSize> rowSlots;
+						bool rowMatches = true;
+						for (int i = 0; i < width && rowMatches; ++i)
+						{
+							rowSlots[i] = findSlot(x + i, y + height, tileTemplateIndex, z);
+							rowMatches = rowSlots[i] != NoSlot;
+						}
+						if (!rowMatches)
+						{
+							break;
+						}
+						for (int i = 0; i < width; ++i)
+						{
+							rectangleSlots[rectangleSlotCount++] = rowSlots[i];
+							merged[rowSlots[i]] = true;
+						}
+					}
+
+					// a single tile is cheaper to draw along with its sides
+					if (rectangleSlotCount == 1)
+					{
+						continue;
+					}
+
+					assert(mergedTopCount < MaxMergedTopsPerCluster);
+					MergedTopData& mergedTop = mergedTops[mergedTopCount++];
+					mergedTop.origin = glm::vec4(m_tilePositions[tileIndex], 1.f);
+					mergedTop.size = glm::vec2(static_cast<float>(width), static_cast<float>(height));
+					mergedTop.tileTemplateIndex = tileTemplateIndex;
+					// the merged top repeats a single variant
+					mergedTop.tileVariantIndex = 0;
+					for (int i = 0; i < rectangleSlotCount; ++i)
+					{
+						topsMerged[rectangleSlots[i]] = true;
+					}
+				}
+			}
+		}
+
+		const MergedTopRange& range = reserveMergedTops(clusterIndex, mergedTopCount);
+		for (GLuint i = 0; i < mergedTopCount; ++i)
+		{
+			m_mergedTopsBuffer.setObject(range.first + i, mergedTops[i]);
+		}
+		clusterData.firstMergedTop = range.first;
+		clusterData.mergedTopCount = mergedTopCount;
+		m_clustersBuffer.setObject(clusterIndex, clusterData);
+
+		for (GLuint slot = 0; slot < clusterData.tileCount; ++slot)
+		{
+			const GLuint tileIndex = getClusterTile(clusterIndex, slot);
+			if (m_tileTopsMerged[tileIndex] != topsMerged[slot])
+			{
+				setTileTopMerged(tileIndex, topsMerged[slot]);
+				m_tilesBuffer.setObject(tileIndex, makeTileData(tileIndex));
+			}
+		}
+	}
+
+	GLuint getClusterTile(GLuint clusterIndex, GLuint slot) const
+	{
+		return m_clusterTilesBuffer.getObject(clusterIndex * MaxTilesPerCluster + slot);
+	}
+
+	// the draw groups split the culled instances between them in proportion to their tile count, when merging tops
+	// the tiles whose top is merged count in the group without the top, or in none if the top was their only face
+	void uploadDrawGroups(bool mergeTops)
+	{
+		if (!m_drawGroupsDirty && mergeTops == m_drawGroupsMergingTops)
+		{
+			return;
+		}
+
+		m_drawGroupsBuffer.clearObjects();
+		GLuint baseInstance = 0;
+		for (size_t groupIndex = 0; groupIndex < m_drawGroups.size(); ++groupIndex)
+		{
+			DrawElementsIndirectCommand drawGroup = m_drawGroups[groupIndex];
+			const GLuint faceMask = static_cast<GLuint>(groupIndex % TileFaceMask_Count);
+			if (mergeTops && (faceMask & TileFaceMask_Top) != 0)
+			{
+				drawGroup.instanceCount -= m_drawGroupMergedTopCounts[groupIndex];
+			}
+			else if (mergeTops && faceMask != TileFaceMask_None)
+			{
+				drawGroup.instanceCount += m_drawGroupMergedTopCounts[groupIndex + TileFaceMask_Top];
+			}
+			drawGroup.baseInstance = baseInstance;
+			baseInstance += drawGroup.instanceCount;
+			m_drawGroupsBuffer.addObject(drawGroup);
+		}
+		m_drawGroupsBuffer.upload();
+		m_drawGroupsDirty = false;
+		m_drawGroupsMergingTops = mergeTops;
+	}
+
+	// the isometric view looks along one of the diagonals depending on the rotation quadrant
+	int getViewQuadrant() const
+	{
+		const int quadrant = static_cast<int>(std::round(m_viewRotation / glm::half_pi<float>()));
+		return ((quadrant % 4) + 4) % 4;
+	}
+
+	// sorts the clusters front to back when the view quadrant changes or clusters are added
+	void updateClusterOrder()
+	{
+		const int quadrant = getViewQuadrant();
+		const size_t clusterCount = m_clustersBuffer.getObjectCount();
+		if (quadrant == m_sortedQuadrant && clusterCount == m_sortedClusterCount && !m_clusterOrderDirty)
+		{
+			return;
+		}
+
+		// horizontal direction towards the camera for each quadrant
+		static const glm::vec2 frontDirections[] = {
+			glm::vec2(1.f, 1.f),
+			glm::vec2(1.f, -1.f),
+			glm::vec2(-1.f, -1.f),
+			glm::vec2(-1.f, 1.f)
+		};
+		const glm::vec2& frontDirection = frontDirections[quadrant];
+
+		m_sortItems.resize(clusterCount);
+		for (size_t i = 0; i < clusterCount; ++i)
+		{
+			const TileClusterData& clusterData = m_clustersBuffer.getObject(i);
+			const glm::vec2 center = (glm::vec2(clusterData.boundsMin) + glm::vec2(clusterData.boundsMax)) * 0.5f;
+			m_sortItems[i].key = getRadixSortKey(-glm::dot(center, frontDirection));
+			m_sortItems[i].value = static_cast<std::uint32_t>(i);
+		}
+		m_radixSort.sort(m_sortItems);
+
+		m_clusterOrderBuffer.clearObjects();
+		for (const RadixSortItem& item : m_sortItems)
+		{
+			m_clusterOrderBuffer.addObject(item.value);
+		}
+		m_clusterOrderBuffer.upload();
+
+		m_sortedQuadrant = quadrant;
+		m_sortedClusterCount = clusterCount;
+		m_clusterOrderDirty = false;
+	}
+
+	void addTileToCluster(GLuint tileIndex, const glm::vec3& tilePosition)
+	{
+		const glm::ivec2 tileCell = getTileCell(tilePosition);
+		const glm::ivec2 clusterCell(
+			static_cast<int>(std::floor(static_cast<float>(tileCell.x) / ClusterSize)),
+			static_cast<int>(std::floor(static_cast<float>(tileCell.y) / ClusterSize))
+		);
+		const std::int64_t cellKey = getCellKey(clusterCell.x, clusterCell.y);
+
+		// stacked tiles overflowing a cluster open a new one for the same cell, clusters left empty are reused first
+		auto it = m_openClusters.find(cellKey);
+		if (it == m_openClusters.end() || m_clustersBuffer.getObject(it->second).tileCount == MaxTilesPerCluster)
+		{
+			TileClusterData clusterData;
+			clusterData.boundsMin = glm::vec4(tilePosition + m_tileBoundsMin, 1.f);
+			clusterData.boundsMax = glm::vec4(tilePosition + m_tileBoundsMax, 1.f);
+			clusterData.tileCount = 0;
+			clusterData.firstMergedTop = 0;
+			clusterData.mergedTopCount = 0;
+
+			GLuint clusterIndex;
+			if (!m_freeClusters.empty())
+			{
+				clusterIndex = m_freeClusters.back();
+				m_freeClusters.pop_back();
+				m_clustersBuffer.setObject(clusterIndex, clusterData);
+				m_clusterCells[clusterIndex] = clusterCell;
+				m_clusterMergeTops[clusterIndex] = true;
+			}
+			else
+			{
+				clusterIndex = static_cast<GLuint>(m_clustersBuffer.getObjectCount());
+				m_clustersBuffer.addObject(clusterData);
+				m_clusterCells.push_back(clusterCell);
+				m_clusterMergeTops.push_back(true);
+				m_clusterMergedTopsDirty.push_back(false);
+				m_clusterMergedTopRanges.push_back(MergedTopRange{ 0, 0 });
+				for (GLuint i = 0; i < MaxTilesPerCluster; ++i)
+				{
+					m_clusterTilesBuffer.addObject(InvalidTileIndex);
+				}
+			}
+			it = m_openClusters.insert_or_assign(cellKey, clusterIndex).first;
+			m_clusterOrderDirty = true;
+		}
+
+		const GLuint clusterIndex = it->second;
+		TileClusterData clusterData = m_clustersBuffer.getObject(clusterIndex);
+		m_clusterTilesBuffer.setObject(clusterIndex * MaxTilesPerCluster + clusterData.tileCount, tileIndex);
+		++clusterData.tileCount;
+		m_clustersBuffer.setObject(clusterIndex, clusterData);
+		m_tileClusters[tileIndex] = clusterIndex;
+		markMergedTopsDirty(clusterIndex);
+
+		growCluster(clusterIndex, tilePosition);
+	}
+
+	// the last tile of the cluster takes the slot of the removed one, the cluster bounds don't shrink
+	void removeTileFromCluster(GLuint tileIndex)
+	{
+		const GLuint clusterIndex = m_tileClusters[tileIndex];
+		TileClusterData clusterData = m_clustersBuffer.getObject(clusterIndex);
+		GLuint slot = 0;
+		while (getClusterTile(clusterIndex, slot) != tileIndex)
+		{
+			++slot;
+			assert(slot < clusterData.tileCount);
+		}
+		--clusterData.tileCount;
+		m_clusterTilesBuffer.setObject(clusterIndex * MaxTilesPerCluster + slot, getClusterTile(clusterIndex, clusterData.tileCount));
+		m_clusterTilesBuffer.setObject(clusterIndex * MaxTilesPerCluster + clusterData.tileCount, InvalidTileIndex);
+		m_tileClusters[tileIndex] = InvalidClusterIndex;
+		markMergedTopsDirty(clusterIndex);
+
+		if (clusterData.tileCount == 0)
+		{
+			clusterData.mergedTopCount = 0;
+			auto it = m_openClusters.find(getCellKey(m_clusterCells[clusterIndex].x, m_clusterCells[clusterIndex].y));
+			if (it != m_openClusters.end() && it->second == clusterIndex)
+			{
+				m_openClusters.erase(it);
+			}
+			m_freeClusters.push_back(clusterIndex);
+			m_clusterOrderDirty = true;
+		}
+		m_clustersBuffer.setObject(clusterIndex, clusterData);
+	}
+
+	void growCluster(GLuint clusterIndex, const glm::vec3& tilePosition)
+	{
+		TileClusterData clusterData = m_clustersBuffer.getObject(clusterIndex);
+		clusterData.boundsMin = glm::min(clusterData.boundsMin, glm::vec4(tilePosition + m_tileBoundsMin, 1.f));
+		clusterData.boundsMax = glm::max(clusterData.boundsMax, glm::vec4(tilePosition + m_tileBoundsMax, 1.f));
+		m_clustersBuffer.setObject(clusterIndex, clusterData);
+	}
+
+	// writes the visible tiles of the first commandCount commands to the culled instances
+	// and the commands that still have tiles to draw, along with their count, to the culled commands
+	void cull(GLsizei commandCount)
+	{
+		const bool mergeTops = isMergingTops();
+		uploadDrawGroups(mergeTops);
+		updateClusterOrder();
+
+		const GLuint groupCount = static_cast<GLuint>(m_drawGroups.size());
+		m_culledInstancesBuffer.reserve(m_tilesBuffer.getObjectCount() * sizeof(GLuint));
+		// opaque commands followed by translucent ones and by the merged tops command
+		m_culledCommandsBuffer.reserve((2 * groupCount + 1) * sizeof(DrawElementsIndirectCommand));
+		m_culledMergedTopsBuffer.reserve(std::max<size_t>(1, m_mergedTopsBuffer.getObjectCount()) * sizeof(GLuint));
+		const GLsizeiptr cullCountersSize = (4 + 2 * groupCount) * sizeof(GLuint);
+		m_cullCountersBuffer.reserve(cullCountersSize);
+
+		// opaque, translucent and merged tops draw counts followed by the number of opaque and translucent visible tiles of each draw group
+		const GLuint zero = 0;
+		glClearNamedBufferSubData(m_cullCountersBuffer.getHandle(), GL_R32UI, m_cullCountersBuffer.getOffset(), cullCountersSize, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+
+		m_perFrameDataBuffer.bind(GL_UNIFORM_BUFFER, PerFrameBufferIndex);
+		m_tilesBuffer.bind(GL_SHADER_STORAGE_BUFFER, TilesBufferIndex);
+		m_tileTemplatesBuffer.bind(GL_SHADER_STORAGE_BUFFER, TileTemplatesBufferIndex);
+		m_culledInstancesBuffer.bind(GL_SHADER_STORAGE_BUFFER, InstancesBufferIndex);
+		m_indirectCommandsBuffer.bind(GL_SHADER_STORAGE_BUFFER, CommandsBufferIndex);
+		m_culledCommandsBuffer.bind(GL_SHADER_STORAGE_BUFFER, CulledCommandsBufferIndex);
+		m_cullCountersBuffer.bind(GL_SHADER_STORAGE_BUFFER, CullCountersBufferIndex);
+		m_clustersBuffer.bind(GL_SHADER_STORAGE_BUFFER, ClustersBufferIndex);
+		m_clusterTilesBuffer.bind(GL_SHADER_STORAGE_BUFFER, ClusterTilesBufferIndex);
+		m_drawGroupsBuffer.bind(GL_SHADER_STORAGE_BUFFER, DrawGroupsBufferIndex);
+		m_clusterOrderBuffer.bind(GL_SHADER_STORAGE_BUFFER, ClusterOrderBufferIndex);
+		m_culledMergedTopsBuffer.bind(GL_SHADER_STORAGE_BUFFER, MergedTopInstancesBufferIndex);
+
+		// one work group per cluster in front to back order, the clusters culled as a whole skip their tiles
+		const GLuint clusterCount = static_cast<GLuint>(m_clustersBuffer.getObjectCount());
+		const GLuint orderedClusterCount = static_cast<GLuint>(m_clusterOrderBuffer.getObjectCount());
+		glProgramUniform1ui(m_cullProgram.getProgramId(), 2, static_cast<GLuint>(commandCount));
+		glProgramUniform1ui(m_cullProgram.getProgramId(), 3, clusterCount);
+		glProgramUniform1ui(m_cullProgram.getProgramId(), 4, orderedClusterCount);
+		glProgramUniform1i(m_cullProgram.getProgramId(), 5, mergeTops);
+		const bool occlusionCulling = m_occlusionCulling && m_depthPyramid.isValid();
+		glProgramUniform1i(m_cullProgram.getProgramId(), OcclusionCullingUniformLocation, occlusionCulling);
+		if (occlusionCulling)
+		{
+			const glm::ivec2& depthPyramidSize = m_depthPyramid.getSize();
+			glProgramUniformMatrix4fv(m_cullProgram.getProgramId(), DepthPyramidViewProjectionUniformLocation, 1, GL_FALSE, &m_depthPyramidViewProjection[0][0]);
+			glProgramUniform2i(m_cullProgram.getProgramId(), DepthPyramidSizeUniformLocation, depthPyramidSize.x, depthPyramidSize.y);
+			glProgramUniform1i(m_cullProgram.getProgramId(), DepthPyramidLevelCountUniformLocation, m_depthPyramid.getLevelCount());
+			glBindTextureUnit(DepthPyramidTextureUnit, m_depthPyramid.getTexture());
+		}
+		if (clusterCount > 0)
+		{
+			const GLuint groupCountX = std::min(orderedClusterCount, MaxWorkGroupCount);
+			const GLuint groupCountY = (orderedClusterCount + groupCountX - 1) / groupCountX;
+			m_cullProgram.use();
+			glDispatchCompute(groupCountX, groupCountY, 1);
+			glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+		}
+
+		m_compactProgram.use();
+		glProgramUniform1ui(m_compactProgram.getProgramId(), 0, groupCount);
+		glDispatchCompute((groupCount + CullGroupSize - 1) / CullGroupSize, 1, 1);
+		glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+	}
+
+	// the tile data is packed again from the tile state kept on the CPU since the tiles buffer may be write only
+	TileData makeTileData(GLuint tileIndex) const
+	{
+		return packTileData(
+			getTileCell(m_tilePositions[tileIndex]),
+			m_tilePositions[tileIndex].z,
+			m_tileTemplateIndices[tileIndex],
+			m_tileVariantIndices[tileIndex],
+			getTileFaceMask(tileIndex) | (m_tileTopsMerged[tileIndex] ? TileFaceMask_TopMerged : TileFaceMask_None)
+		);
+	}
+
 protected:
 	static constexpr GLuint PerFrameBufferIndex = 0;
 	static constexpr GLuint TilesBufferIndex = 1;
 	static constexpr GLuint TileTemplatesBufferIndex = 2;
+	static constexpr GLuint InstancesBufferIndex = 3;
+	static constexpr GLuint CommandsBufferIndex = 4;
+	static constexpr GLuint CulledCommandsBufferIndex = 5;
+	static constexpr GLuint CullCountersBufferIndex = 6;
+	static constexpr GLuint ClustersBufferIndex = 7;
+	static constexpr GLuint ClusterTilesBufferIndex = 8;
+	static constexpr GLuint DrawGroupsBufferIndex = 10;
+	static constexpr GLuint ClusterOrderBufferIndex = 11;
+	static constexpr GLuint MergedTopsBufferIndex = 12;
+	static constexpr GLuint MergedTopInstancesBufferIndex = 13;
+	static constexpr GLuint TileVerticesBufferIndex = 14;
+
+	static constexpr GLint AlphaTestUniformLocation = 0;
+	// tile culling against the depth pyramid, the matrix takes 4 locations
+	static constexpr GLint OcclusionCullingUniformLocation = 8;
+	static constexpr GLint DepthPyramidViewProjectionUniformLocation = 9;
+	static constexpr GLint DepthPyramidSizeUniformLocation = 13;
+	static constexpr GLint DepthPyramidLevelCountUniformLocation = 14;
+	static constexpr GLuint DepthPyramidTextureUnit = 0;
+
+	// local size of the culling compute shaders, the tile culling one matches the cluster size
+	static constexpr GLuint CullGroupSize = 64;
+	static_assert(CullGroupSize == MaxTilesPerCluster);
+	// guaranteed minimum of GL_MAX_COMPUTE_WORK_GROUP_COUNT
+	static constexpr GLuint MaxWorkGroupCount = 65535;
+	// tiles placed by each worker thread at least, a chunk is split between a few threads
+	static constexpr size_t MinTilesPerThread = 256;
+
+	// unused tile slot of a cluster
+	static constexpr GLuint InvalidTileIndex = ~0u;
+	// draw group and cluster of a free tile slot
+	static constexpr GLuint InvalidDrawGroup = ~0u;
+	static constexpr GLuint InvalidClusterIndex = ~0u;
 
 	std::vector<TileTemplate> m_tileTemplates;
+	bool m_hasTranslucentTemplates;
 
-	GLMutableBuffer<PerFrameData> m_perFrameDataBuffer;
+	GLMutableBuffer<PerFrameData, PerFrameUpdateStrategy> m_perFrameDataBuffer;
 
 	GLuint m_vao;
 	GLBuffer m_indicesBuffer;
-	GLBuffer m_verticesBuffer;
 
 	GLArrayBuffer<TileTemplateData, MaxTileTemplates> m_tileTemplatesBuffer;
-	GLArrayBuffer<TileData, MaxTiles> m_tilesBuffer;
+	// TileVertexCount vertices for each template
+	GLArrayBuffer<TileVertex, MaxTileTemplates * TileVertexCount> m_tileVerticesBuffer;
+	std::vector<float> m_tileTemplateHeights;
+	TilesBuffer m_tilesBuffer;
+
+	GLIndirectCommandsBuffer<MaxCommands> m_indirectCommandsBuffer;
+
+	// local bounds of the tile geometry around the tile position
+	glm::vec3 m_tileBoundsMin;
+	glm::vec3 m_tileBoundsMax;
 
-	GLIndirectCommandsBuffer<MaxTiles> m_indirectCommandsBuffer;
+	GLArrayBuffer<TileClusterData, MaxTileClusters> m_clustersBuffer;
+	GLArrayBuffer<GLuint, MaxTileClusters * MaxTilesPerCluster> m_clusterTilesBuffer;
+	// cluster of each tile, the last cluster opened for each cluster cell of the map and the clusters left without tiles
+	std::vector<GLuint> m_tileClusters;
+	std::unordered_map<std::int64_t, GLuint> m_openClusters;
+	std::vector<GLuint> m_freeClusters;
+
+	// tiles of each cell of the map as linked lists, to find the side faces hidden by the neighbouring tiles
+	std::vector<glm::vec3> m_tilePositions;
+	std::vector<GLuint> m_nextTileInCell;
+	std::unordered_map<std::int64_t, GLuint> m_cellFirstTile;
+	// geometry and face mask of each tile
+	std::vector<GLuint> m_tileDrawGroups;
+	std::vector<GLuint> m_tileTemplateIndices;
+	std::vector<GLuint> m_tileVariantIndices;
+
+	// scratch of placeTiles(): the ranges placed by addTiles(), the first tile of each range and the one
+	// after the last range, the tile data of each range, the variant generator of each thread and the tile
+	// count of each thread and draw group
+	WorkerThreads m_workerThreads;
+	std::vector<TileSlotRange> m_placedRanges;
+	std::vector<size_t> m_rangeFirstTiles;
+	std::vector<TileData*> m_rangeTiles;
+	std::vector<std::minstd_rand> m_threadRandoms;
+	std::vector<GLuint> m_threadGroupCounts;
+
+	// first tile of the blocks to reuse and the fence signalled once the GPU no longer reads their tiles
+	std::deque<std::pair<GLuint, GLsync>> m_releasedTileBlocks;
+
+	// coplanar tops merged when zoomed out, rebaked on upload for the clusters marked dirty, the free ranges
+	// of merged tops are kept by power of two
+	float m_zoom;
+	float m_mergeTopsMaxZoom;
+	std::vector<glm::ivec2> m_clusterCells;
+	std::vector<bool> m_clusterMergeTops;
+	std::vector<bool> m_clusterMergedTopsDirty;
+	std::vector<GLuint> m_dirtyMergedTopClusters;
+	std::vector<MergedTopRange> m_clusterMergedTopRanges;
+	std::array<std::vector<GLuint>, MergedTopRangeClassCount> m_freeMergedTopRanges;
+	std::vector<bool> m_tileTopsMerged;
+	GLArrayBuffer<MergedTopData, MaxMergedTops> m_mergedTopsBuffer;
+
+	// geometry of each template, and the index range, base vertex and tile count of each geometry and face mask
+	std::vector<DrawElementsIndirectCommand> m_geometries;
+	std::vector<DrawElementsIndirectCommand> m_drawGroups;
+	// tiles of each draw group whose top is merged
+	std::vector<GLuint> m_drawGroupMergedTopCounts;
+	GLArrayBuffer<DrawElementsIndirectCommand, MaxDrawGroups> m_drawGroupsBuffer;
+	bool m_drawGroupsDirty;
+	bool m_drawGroupsMergingTops;
+
+	// clusters sorted front to back for the view quadrant they were sorted for
+	float m_viewRotation;
+	int m_sortedQuadrant;
+	size_t m_sortedClusterCount;
+	bool m_clusterOrderDirty;
+	RadixSort m_radixSort;
+	std::vector<RadixSortItem> m_sortItems;
+	GLArrayBuffer<GLuint, MaxTileClusters> m_clusterOrderBuffer;
+
+	// depth of the opaque tiles of the previous frame, and the view projection they were drawn with
+	bool m_occlusionCulling;
+	DepthPyramid m_depthPyramid;
+	glm::mat4 m_viewProjection;
+	glm::mat4 m_depthPyramidViewProjection;
+
+	// the outputs of the culling pass share the pages of a single allocator instead of a buffer object each
+	GLBufferAllocator m_cullAllocator;
+	GLDeviceSlice m_culledInstancesBuffer;
+	GLDeviceSlice m_culledCommandsBuffer;
+	GLDeviceSlice m_cullCountersBuffer;
+	GLDeviceSlice m_culledMergedTopsBuffer;
 
 	GLProgram m_tileProgram;
+	GLProgram m_cullProgram;
+	GLProgram m_compactProgram;
+	GLProgram m_mergedTopProgram;
+
+	// only accessed from the render thread
+	bool m_uploadingAsync;
 };
@@ -0,0 +1,404 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include <GL/glew.h>
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+
+#include "Camera.h"
+#include "TileChunk.h"
+
+// loads the chunks of a map around the camera and evicts the chunks left behind once their GPU memory exceeds a budget,
+// the tiles of the chunks are generated on a thread of the streamer and the render thread only places the tiles
+// generated already, a few chunks per frame, so that it never waits for the generation
+class TileStreamer
+{
+public:
+	// fills the tiles of the chunk with the given coordinates, called on the generator thread
+	using GenerateChunk = std::function<void(const glm::ivec2& coords, std::vector<TileMesh::TilePlacement>& tiles)>;
+
+	// GPU bytes taken by a chunk with a single tile per cell, the budget is spent ahead by the chunks being generated
+	static constexpr int FullChunkTiles = TileChunk::Size * TileChunk::Size;
+	static constexpr GLsizeiptr FullChunkBytes =
+		(FullChunkTiles + TileMesh::TileBlockSize - 1) / TileMesh::TileBlockSize * TileMesh::TileBlockSize * TileMesh::TileSlotBytes
+		+ FullChunkTiles / TileMesh::MaxTilesPerCluster * TileMesh::ClusterBytes;
+
+	TileStreamer(const TileStreamer&) = delete;
+	TileStreamer(TileStreamer&&) = delete;
+	void operator=(const TileStreamer&) = delete;
+	void operator=(TileStreamer&&) = delete;
+
+	// the map must outlive the streamer
+	TileStreamer(TileChunkMap& chunkMap, GenerateChunk generateChunk)
+		: m_chunkMap(chunkMap)
+		, m_generateChunk(std::move(generateChunk))
+		, m_loadMargin(static_cast<float>(TileChunk::Size))
+		, m_evictMargin(static_cast<float>(TileChunk::Size * 4))
+		, m_memoryBudget(TileMesh::MaxTiles / 2 / FullChunkTiles * FullChunkBytes)
+		, m_maxLoadsPerFrame(4)
+		, m_frameIndex(0)
+		, m_viewRadius(0.f)
+		, m_running(true)
+	{
+		m_thread = std::thread(&TileStreamer::run, this);
+	}
+
+	~TileStreamer()
+	{
+		stop();
+	}
+
+	// the chunks being generated are dropped
+	void stop()
+	{
+		if (!m_thread.joinable())
+		{
+			return;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_running = false;
+		}
+		m_condition.notify_one();
+		m_thread.join();
+	}
+
+	// the chunks within the view radius plus the load margin are loaded, those beyond the view radius plus
+	// the evict margin can be evicted, the evict margin keeps the chunks around the view when going back and forth
+	void setLoadMargin(float loadMargin)
+	{
+		assert(loadMargin >= 0.f && loadMargin <= m_evictMargin);
+		m_loadMargin = loadMargin;
+	}
+
+	void setEvictMargin(float evictMargin)
+	{
+		assert(evictMargin >= m_loadMargin);
+		m_evictMargin = evictMargin;
+	}
+
+	// GPU bytes of the tile slots and clusters of the loaded and requested chunks, see TileChunk::getResidentBytes(),
+	// the full chunks it holds must fit in TileMesh::MaxTiles, the buffers of the mesh keep their largest size and
+	// the evicted chunks only free slots and clusters for the next ones
+	void setMemoryBudget(GLsizeiptr memoryBudget)
+	{
+		assert(memoryBudget / FullChunkBytes * FullChunkTiles <= TileMesh::MaxTiles);
+		m_memoryBudget = memoryBudget;
+	}
+
+	void setMaxLoadsPerFrame(int maxLoadsPerFrame)
+	{
+		assert(maxLoadsPerFrame > 0);
+		m_maxLoadsPerFrame = maxLoadsPerFrame;
+	}
+
+	// to call from the render thread every frame before drawing the mesh, the chunks nearest to the camera center
+	// are requested first, the mesh is uploaded when chunks were loaded or evicted
+	void update(const Camera& camera, const glm::mat4& viewProjection)
+	{
+		++m_frameIndex;
+		const glm::vec3& center = camera.getCenter();
+		m_viewRadius = getViewRadius(center, viewProjection);
+		const glm::vec2 center2d(center);
+		const float loadRadius = m_viewRadius + m_loadMargin;
+		const float evictRadius = m_viewRadius + m_evictMargin;
+
+		updateVisibleChunks(viewProjection);
+		loadGeneratedChunks(center2d, evictRadius);
+		requestChunks(center2d, loadRadius, evictRadius);
+		m_chunkMap.update();
+	}
+
+	// distance from the camera center to the farthest corner of the viewport in the last update()
+	float getViewRadius() const { return m_viewRadius; }
+	// requested chunks not loaded yet
+	size_t getPendingChunkCount() const { return m_pendingChunks.size(); }
+
+protected:
+	struct GeneratedChunk
+	{
+		glm::ivec2 coords;
+		std::vector<TileMesh::TilePlacement> tiles;
+	};
+
+	struct ResidentChunk
+	{
+		glm::ivec2 coords;
+		std::uint64_t lastVisibleFrame;
+	};
+
+	// the viewport corners are projected on the horizontal plane of the camera center
+	static float getViewRadius(const glm::vec3& center, const glm::mat4& viewProjection)
+	{
+		const glm::mat4 inverseViewProjection = glm::inverse(viewProjection);
+		float viewRadius = 0.f;
+		for (int corner = 0; corner < 4; ++corner)
+		{
+			const glm::vec2 ndc(corner & 1 ? 1.f : -1.f, corner & 2 ? 1.f : -1.f);
+			glm::vec4 nearPoint = inverseViewProjection * glm::vec4(ndc, -1.f, 1.f);
+			glm::vec4 farPoint = inverseViewProjection * glm::vec4(ndc, 1.f, 1.f);
+			nearPoint /= nearPoint.w;
+			farPoint /= farPoint.w;
+			glm::vec3 point = glm::vec3(nearPoint);
+			if (std::abs(farPoint.z - nearPoint.z) > glm::epsilon<float>())
+			{
+				point = glm::mix(glm::vec3(nearPoint), glm::vec3(farPoint), (center.z - nearPoint.z) / (farPoint.z - nearPoint.z));
+			}
+			viewRadius = std::max(viewRadius, glm::distance(glm::vec2(point), glm::vec2(center)));
+		}
+		return viewRadius;
+	}
+
+	// distance from the point to the nearest cell of the chunk
+	static float getChunkDistance(const glm::vec2& point, const glm::ivec2& coords)
+	{
+		const glm::vec2 boundsMin = glm::vec2(coords * TileChunk::Size) - 0.5f;
+		const glm::vec2 boundsMax = boundsMin + static_cast<float>(TileChunk::Size);
+		return glm::distance(point, glm::clamp(point, boundsMin, boundsMax));
+	}
+
+	// the bounds of the tile positions of the chunk overlap the viewport
+	static bool isChunkVisible(const glm::mat4& viewProjection, const TileChunk& chunk)
+	{
+		glm::vec3 boundsMin = chunk.getBoundsMin();
+		glm::vec3 boundsMax = chunk.getBoundsMax();
+		if (boundsMin.z > boundsMax.z)
+		{
+			return false;
+		}
+		glm::vec2 ndcMin(std::numeric_limits<float>::max());
+		glm::vec2 ndcMax(std::numeric_limits<float>::lowest());
+		for (int corner = 0; corner < 8; ++corner)
+		{
+			const glm::vec3 point(
+				corner & 1 ? boundsMax.x : boundsMin.x,
+				corner & 2 ? boundsMax.y : boundsMin.y,
+				corner & 4 ? boundsMax.z : boundsMin.z
+			);
+			const glm::vec4 clipPoint = viewProjection * glm::vec4(point, 1.f);
+			const glm::vec2 ndc = glm::vec2(clipPoint) / clipPoint.w;
+			ndcMin = glm::min(ndcMin, ndc);
+			ndcMax = glm::max(ndcMax, ndc);
+		}
+		return glm::all(glm::lessThanEqual(ndcMin, glm::vec2(1.f))) && glm::all(glm::greaterThanEqual(ndcMax, glm::vec2(-1.f)));
+	}
+
+	void updateVisibleChunks(const glm::mat4& viewProjection)
+	{
+		for (auto& [key, residentChunk] : m_residentChunks)
+		{
+			const TileChunk* chunk = m_chunkMap.findChunk(residentChunk.coords);
+			assert(chunk != nullptr && chunk->isLoaded());
+			if (isChunkVisible(viewProjection, *chunk))
+			{
+				residentChunk.lastVisibleFrame = m_frameIndex;
+			}
+		}
+	}
+
+	// the chunks generated meanwhile wait on the render thread until their turn, those left beyond the evict
+	// radius are dropped as they would be the first evicted
+	void loadGeneratedChunks(const glm::vec2& center, float evictRadius)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			while (!m_generatedChunks.empty())
+			{
+				m_readyChunks.push_back(std::move(m_generatedChunks.front()));
+				m_generatedChunks.pop_front();
+			}
+		}
+
+		int loadCount = 0;
+		while (!m_readyChunks.empty() && loadCount < m_maxLoadsPerFrame)
+		{
+			GeneratedChunk& generatedChunk = m_readyChunks.front();
+			const std::int64_t key = TileChunkMap::getChunkKey(generatedChunk.coords);
+			m_pendingChunks.erase(key);
+			if (getChunkDistance(center, generatedChunk.coords) <= evictRadius)
+			{
+				TileChunk& chunk = m_chunkMap.getOrAddChunk(generatedChunk.coords);
+				assert(!chunk.isLoaded());
+				chunk.setTiles(std::move(generatedChunk.tiles));
+				m_chunkMap.loadChunk(chunk);
+				m_residentChunks[key] = { generatedChunk.coords, m_frameIndex };
+				++loadCount;
+			}
+			m_readyChunks.pop_front();
+		}
+	}
+
+	// the chunks are evicted least recently visible first, only to make room for nearer chunks,
+	// and no more chunks are requested than the budget can hold
+	void requestChunks(const glm::vec2& center, float loadRadius, float evictRadius)
+	{
+		// the requests not started yet are cancelled once beyond the evict radius
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			for (size_t i = 0; i < m_requests.size();)
+			{
+				if (getChunkDistance(center, m_requests[i]) > evictRadius)
+				{
+					m_pendingChunks.erase(TileChunkMap::getChunkKey(m_requests[i]));
+					m_requests.erase(m_requests.begin() + i);
+				}
+				else
+				{
+					++i;
+				}
+			}
+		}
+
+		// a disc of chunks larger than the budget is never loaded whatever the zoom
+		const float maxChunkRadius = std::sqrt(static_cast<float>(m_memoryBudget / FullChunkBytes) / glm::pi<float>()) + 1.f;
+		const int chunkRadius = static_cast<int>(std::ceil(std::min(loadRadius / TileChunk::Size, maxChunkRadius)));
+		const glm::ivec2 centerCoords = TileChunkMap::getChunkCoords(glm::vec3(center, 0.f));
+		m_requestedChunks.clear();
+		for (int y = -chunkRadius; y <= chunkRadius; ++y)
+		{
+			for (int x = -chunkRadius; x <= chunkRadius; ++x)
+			{
+				const glm::ivec2 coords = centerCoords + glm::ivec2(x, y);
+				const float distance = getChunkDistance(center, coords);
+				const std::int64_t key = TileChunkMap::getChunkKey(coords);
+				// the map ends where the cells no longer fit in the tile data
+				if (distance <= loadRadius && TileChunkMap::isChunkInRange(coords)
+					&& m_residentChunks.count(key) == 0 && m_pendingChunks.count(key) == 0)
+				{
+					m_requestedChunks.emplace_back(distance, coords);
+				}
+			}
+		}
+		std::sort(m_requestedChunks.begin(), m_requestedChunks.end(), [](const auto& a, const auto& b)
+		{
+			return a.first < b.first;
+		});
+
+		m_evictableChunks.clear();
+		for (const auto& [key, residentChunk] : m_residentChunks)
+		{
+			if (getChunkDistance(center, residentChunk.coords) > evictRadius)
+			{
+				m_evictableChunks.emplace_back(residentChunk.lastVisibleFrame, residentChunk.coords);
+			}
+		}
+		std::sort(m_evictableChunks.begin(), m_evictableChunks.end(), [](const auto& a, const auto& b)
+		{
+			return a.first < b.first;
+		});
+
+		size_t evictedCount = 0;
+		auto makeRoom = [this, &evictedCount](GLsizeiptr bytes)
+		{
+			while (getCommittedBytes() + bytes > m_memoryBudget && evictedCount < m_evictableChunks.size())
+			{
+				evictChunk(m_evictableChunks[evictedCount++].second);
+			}
+			return getCommittedBytes() + bytes <= m_memoryBudget;
+		};
+
+		makeRoom(0);
+		size_t requestCount = 0;
+		while (requestCount < m_requestedChunks.size() && makeRoom(FullChunkBytes))
+		{
+			m_pendingChunks.insert(TileChunkMap::getChunkKey(m_requestedChunks[requestCount].second));
+			++requestCount;
+		}
+		if (requestCount > 0)
+		{
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				for (size_t i = 0; i < requestCount; ++i)
+				{
+					m_requests.push_back(m_requestedChunks[i].second);
+				}
+			}
+			m_condition.notify_one();
+		}
+	}
+
+	void evictChunk(const glm::ivec2& coords)
+	{
+		TileChunk* chunk = m_chunkMap.findChunk(coords);
+		assert(chunk != nullptr);
+		m_chunkMap.unloadChunk(*chunk);
+		m_chunkMap.removeChunk(coords);
+		m_residentChunks.erase(TileChunkMap::getChunkKey(coords));
+	}
+
+	// the loaded chunks and those requested, assumed to take the slots of a full chunk
+	GLsizeiptr getCommittedBytes() const
+	{
+		return m_chunkMap.getResidentBytes() + static_cast<GLsizeiptr>(m_pendingChunks.size()) * FullChunkBytes;
+	}
+
+	void run()
+	{
+		while (true)
+		{
+			GeneratedChunk generatedChunk;
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_condition.wait(lock, [this]() { return !m_running || !m_requests.empty(); });
+				if (!m_running)
+				{
+					return;
+				}
+				generatedChunk.coords = m_requests.front();
+				m_requests.pop_front();
+			}
+
+			m_generateChunk(generatedChunk.coords, generatedChunk.tiles);
+
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_generatedChunks.push_back(std::move(generatedChunk));
+			}
+		}
+	}
+
+protected:
+	TileChunkMap& m_chunkMap;
+	GenerateChunk m_generateChunk;
+	float m_loadMargin;
+	float m_evictMargin;
+	GLsizeiptr m_memoryBudget;
+	int m_maxLoadsPerFrame;
+	std::uint64_t m_frameIndex;
+	float m_viewRadius;
+
+	// render thread only: the chunks loaded by the streamer, those requested or generated and not loaded yet,
+	// and the generated chunks waiting to be loaded
+	std::unordered_map<std::int64_t, ResidentChunk> m_residentChunks;
+	std::unordered_set<std::int64_t> m_pendingChunks;
+	std::deque<GeneratedChunk> m_readyChunks;
+
+	// scratch of requestChunks(): the chunks to request with their distance, and the chunks to evict with
+	// the last frame they were visible
+	std::vector<std::pair<float, glm::ivec2>> m_requestedChunks;
+	std::vector<std::pair<std::uint64_t, glm::ivec2>> m_evictableChunks;
+
+	// shared with the generator thread
+	std::mutex m_mutex;
+	std::condition_variable m_condition;
+	std::deque<glm::ivec2> m_requests;
+	std::deque<GeneratedChunk> m_generatedChunks;
+	bool m_running;
+
+	std::thread m_thread;
+};
@@ -3,26 +3,42 @@
 #include <cassert>
 #include <cstdint>
 #include <memory>
+#include <utility>
 
 #include "BindlessTexture.h"
 
 static constexpr GLuint64 InvalidTexture = 0xFFFFFFFFFFFFFFFF;
 
+enum TileTemplateFlags : GLuint
+{
+	// drawn in the blended pass instead of the alpha tested opaque pass
+	TileTemplateFlag_Translucent = 1 << 0
+};
+
 struct TileTemplateData
 {
 	GLuint64 albedoTexture = InvalidTexture;
 	GLuint numVariants;
 	GLuint numAnimationFrames;
+	GLuint flags = 0;
 };
 
 class TileTemplate
 {
 public:
-	TileTemplate(const std::string& filePath, float* tileVariantProbabilities, int numTileVariants, float frameDuration, GLuint numAnimationFrames)
-		: m_texture(std::make_shared<BindlessTexture>(filePath))
+	TileTemplate(const std::string& filePath, float* tileVariantProbabilities, int numTileVariants, float frameDuration, GLuint numAnimationFrames, bool makeTextureResident = true, bool translucent = false)
+		: TileTemplate(std::make_shared<BindlessTexture>(filePath, makeTextureResident), tileVariantProbabilities, numTileVariants, frameDuration, numAnimationFrames, translucent)
+	{
+
+	}
+
+	// the texture may still be streaming in through an upload queue
+	TileTemplate(std::shared_ptr<BindlessTexture> texture, float* tileVariantProbabilities, int numTileVariants, float frameDuration, GLuint numAnimationFrames, bool translucent = false)
+		: m_texture(std::move(texture))
 		, m_tileVariantProbabilities(tileVariantProbabilities, tileVariantProbabilities + numTileVariants)
 		, m_frameDuration(frameDuration)
 		, m_numAnimationFrames(numAnimationFrames)
+		, m_translucent(translucent)
 	{
 		m_tileVariantProbabilitiesSum = 0.f;
 		for (float probability : m_tileVariantProbabilities)
@@ -32,9 +48,15 @@ public:
 	}
 
 	int getRandomTileVariantIndex() const
+	{
+		return getTileVariantIndex(static_cast<float>(rand()) / RAND_MAX);
+	}
+
+	// variant picked by a random number between 0 and 1, for callers with their own random generator
+	int getTileVariantIndex(float random) const
 	{
 		assert(!m_tileVariantProbabilities.empty() && m_tileVariantProbabilitiesSum > 0.f);
-		float random = static_cast<float>(rand()) / RAND_MAX * m_tileVariantProbabilitiesSum;
+		random *= m_tileVariantProbabilitiesSum;
 		int randomIndex = 0;
 		for (float probability : m_tileVariantProbabilities)
 		{
@@ -49,9 +71,12 @@ public:
 		return randomIndex;
 	}
 
+	void makeTextureResident() { m_texture->makeHandleResident(); }
+
 	const BindlessTexture& getTexture() const { return *m_texture; }
 	GLuint getNumVariants() const { return static_cast<GLuint>(m_tileVariantProbabilities.size()); }
 	GLuint getNumAnimationFrames() const { return m_numAnimationFrames; }
+	bool isTranslucent() const { return m_translucent; }
 
 protected:
 	std::shared_ptr<BindlessTexture> m_texture;
@@ -59,4 +84,5 @@ protected:
 	float m_tileVariantProbabilitiesSum;
 	float m_frameDuration;
 	GLuint m_numAnimationFrames;
+	bool m_translucent;
 };
@@ -0,0 +1,240 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <string>
+#include <vector>
+#include <GL/glew.h>
+
+#include "Buffer.h"
+#include "MemoryRegistry.h"
+
+// spreads large uploads over several frames: each frame process() copies slices of the queued uploads
+// through a persistently mapped staging buffer until the frame budget is spent
+// the source data is copied when an upload is enqueued, it can change or be freed right after
+class GLUploadQueue
+{
+public:
+	using UploadId = std::uint64_t;
+	using ProgressCallback = std::function<void(GLsizeiptr residentBytes)>;
+
+	static constexpr GLsizeiptr DefaultSliceSize = 256 * 1024;
+	static constexpr int DefaultNumSlices = 32;
+	static constexpr GLsizeiptr DefaultFrameByteBudget = 4 * 1024 * 1024;
+	static constexpr float DefaultFrameTimeBudget = 2.f; // milliseconds
+
+	GLUploadQueue(GLsizeiptr sliceSize = DefaultSliceSize, int numSlices = DefaultNumSlices)
+		: m_sliceSize(sliceSize)
+		, m_sliceIndex(0)
+		, m_nextUploadId(0)
+		, m_frameByteBudget(DefaultFrameByteBudget)
+		, m_frameTimeBudget(DefaultFrameTimeBudget)
+		, m_lastFrameUploadBytes(0)
+	{
+		const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		m_stagingBuffer.setName("GLUploadQueue.staging");
+		m_stagingBuffer.update(nullptr, sliceSize * numSlices, flags);
+		m_mappedData = static_cast<std::uint8_t*>(glMapNamedBufferRange(m_stagingBuffer.getHandle(), 0, sliceSize * numSlices, flags));
+		assert(m_mappedData != nullptr);
+
+		m_sliceFences.resize(numSlices, nullptr);
+	}
+
+	GLUploadQueue(const GLUploadQueue&) = delete;
+	void operator=(const GLUploadQueue&) = delete;
+
+	~GLUploadQueue()
+	{
+		for (GLsync fence : m_sliceFences)
+		{
+			if (fence != nullptr)
+			{
+				glDeleteSync(fence);
+			}
+		}
+		glUnmapNamedBuffer(m_stagingBuffer.getHandle());
+	}
+
+	// the destination handle is read when each slice is copied, so the buffer may be reallocated meanwhile
+	UploadId enqueueBuffer(GLBufferBase& destination, GLintptr destinationOffset, const void* data, GLsizeiptr size, ProgressCallback progressCallback = nullptr)
+	{
+		Upload& upload = addUpload(data, size, std::move(progressCallback));
+		upload.buffer = &destination;
+		upload.bufferOffset = destinationOffset;
+		return upload.id;
+	}
+
+	// the texture is filled by bands of whole rows from its first row, it must outlive the upload,
+	// textureName is the name the texture is accounted under in the memory registry
+	UploadId enqueueTexture2D(GLuint texture, const std::string& textureName, GLsizei width, GLsizei height, GLenum format, GLenum type, GLsizei bytesPerPixel, const void* pixels, ProgressCallback progressCallback = nullptr)
+	{
+		assert(static_cast<GLsizeiptr>(width) * bytesPerPixel <= m_sliceSize);
+		Upload& upload = addUpload(pixels, static_cast<GLsizeiptr>(width) * height * bytesPerPixel, std::move(progressCallback));
+		upload.texture = texture;
+		upload.textureName = textureName;
+		upload.textureWidth = width;
+		upload.textureFormat = format;
+		upload.textureType = type;
+		upload.textureBytesPerPixel = bytesPerPixel;
+		return upload.id;
+	}
+
+	// uploads stop for the frame as soon as either budget is exceeded
+	void setFrameBudget(GLsizeiptr bytes, float milliseconds)
+	{
+		m_frameByteBudget = bytes;
+		m_frameTimeBudget = milliseconds;
+	}
+
+	// never blocks: if the next staging slice is still read by the GPU the remaining work waits for the next frame
+	void process()
+	{
+		using Clock = std::chrono::steady_clock;
+		const Clock::time_point startTime = Clock::now();
+
+		m_lastFrameUploadBytes = 0;
+		while (!m_uploads.empty() && m_lastFrameUploadBytes < m_frameByteBudget)
+		{
+			const std::chrono::duration<float, std::milli> elapsedTime = Clock::now() - startTime;
+			if (elapsedTime.count() >= m_frameTimeBudget)
+			{
+				break;
+			}
+
+			GLsync& fence = m_sliceFences[m_sliceIndex];
+			if (fence != nullptr)
+			{
+				const GLenum result = glClientWaitSync(fence, 0, 0);
+				if (result == GL_TIMEOUT_EXPIRED)
+				{
+					break;
+				}
+				assert(result != GL_WAIT_FAILED);
+				glDeleteSync(fence);
+				fence = nullptr;
+			}
+
+			Upload& upload = m_uploads.front();
+			const GLintptr stagingOffset = m_sliceIndex * m_sliceSize;
+			const GLsizeiptr sliceBytes = upload.buffer != nullptr
+				? uploadBufferSlice(upload, stagingOffset)
+				: uploadTextureSlice(upload, stagingOffset);
+
+			fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			m_sliceIndex = (m_sliceIndex + 1) % static_cast<int>(m_sliceFences.size());
+
+			upload.uploadedBytes += sliceBytes;
+			m_lastFrameUploadBytes += sliceBytes;
+
+			// GL commands execute in order, anything issued from now on sees the uploaded bytes
+			if (upload.progressCallback)
+			{
+				upload.progressCallback(upload.uploadedBytes);
+			}
+
+			if (upload.uploadedBytes == static_cast<GLsizeiptr>(upload.data.size()))
+			{
+				m_uploads.pop_front();
+			}
+		}
+	}
+
+	bool isResident(UploadId uploadId) const
+	{
+		return m_uploads.empty() || uploadId < m_uploads.front().id;
+	}
+
+	bool isIdle() const { return m_uploads.empty(); }
+
+	GLsizeiptr getLastFrameUploadBytes() const { return m_lastFrameUploadBytes; }
+
+protected:
+	struct Upload
+	{
+		UploadId id;
+		std::vector<std::uint8_t> data;
+		GLsizeiptr uploadedBytes = 0;
+		ProgressCallback progressCallback;
+
+		GLBufferBase* buffer = nullptr;
+		GLintptr bufferOffset = 0;
+
+		GLuint texture = 0;
+		std::string textureName;
+		GLsizei textureWidth = 0;
+		GLenum textureFormat = 0;
+		GLenum textureType = 0;
+		GLsizei textureBytesPerPixel = 0;
+	};
+
+	Upload& addUpload(const void* data, GLsizeiptr size, ProgressCallback progressCallback)
+	{
+		assert(data != nullptr && size > 0);
+		Upload& upload = m_uploads.emplace_back();
+		upload.id = m_nextUploadId++;
+		upload.data.assign(static_cast<const std::uint8_t*>(data), static_cast<const std::uint8_t*>(data) + size);
+		upload.progressCallback = std::move(progressCallback);
+		return upload;
+	}
+
+	GLsizeiptr uploadBufferSlice(const Upload& upload, GLintptr stagingOffset)
+	{
+		const GLsizeiptr sliceBytes = std::min(m_sliceSize, static_cast<GLsizeiptr>(upload.data.size()) - upload.uploadedBytes);
+		std::memcpy(m_mappedData + stagingOffset, upload.data.data() + upload.uploadedBytes, sliceBytes);
+		glCopyNamedBufferSubData(
+			m_stagingBuffer.getHandle(),
+			upload.buffer->getHandle(),
+			stagingOffset,
+			upload.bufferOffset + upload.uploadedBytes,
+			sliceBytes
+		);
+		upload.buffer->recordUpload(sliceBytes);
+		return sliceBytes;
+	}
+
+	// textures are sliced by whole rows, the staging buffer is the pixel unpack buffer of the copy
+	GLsizeiptr uploadTextureSlice(const Upload& upload, GLintptr stagingOffset)
+	{
+		const GLsizeiptr size = static_cast<GLsizeiptr>(upload.data.size());
+		const GLsizeiptr rowBytes = static_cast<GLsizeiptr>(upload.textureWidth) * upload.textureBytesPerPixel;
+		const GLsizei firstRow = static_cast<GLsizei>(upload.uploadedBytes / rowBytes);
+		const GLsizei remainingRows = static_cast<GLsizei>((size - upload.uploadedBytes) / rowBytes);
+		const GLsizei numRows = std::min(remainingRows, static_cast<GLsizei>(m_sliceSize / rowBytes));
+		const GLsizeiptr sliceBytes = numRows * rowBytes;
+
+		std::memcpy(m_mappedData + stagingOffset, upload.data.data() + upload.uploadedBytes, sliceBytes);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_stagingBuffer.getHandle());
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glTextureSubImage2D(
+			upload.texture,
+			0,
+			0, firstRow,
+			upload.textureWidth, numRows,
+			upload.textureFormat,
+			upload.textureType,
+			reinterpret_cast<const void*>(stagingOffset)
+		);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		GLMemoryRegistry::getInstance().addUpload(upload.textureName, sliceBytes);
+		return sliceBytes;
+	}
+
+protected:
+	GLBuffer m_stagingBuffer;
+	std::uint8_t* m_mappedData;
+	std::vector<GLsync> m_sliceFences;
+	GLsizeiptr m_sliceSize;
+	int m_sliceIndex;
+
+	std::deque<Upload> m_uploads;
+	UploadId m_nextUploadId;
+
+	GLsizeiptr m_frameByteBudget;
+	float m_frameTimeBudget;
+	GLsizeiptr m_lastFrameUploadBytes;
+};
@@ -0,0 +1,167 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// runs a function on several threads at once, the threads are started with the pool and wait for the next call,
+// each call queues a job per thread that the pool threads and the calling thread take in order
+class WorkerThreads
+{
+public:
+	WorkerThreads(const WorkerThreads&) = delete;
+	WorkerThreads(WorkerThreads&&) = delete;
+	void operator=(const WorkerThreads&) = delete;
+	void operator=(WorkerThreads&&) = delete;
+
+	WorkerThreads(unsigned int maxThreads = std::max(1u, std::thread::hardware_concurrency()))
+		: m_maxThreads(maxThreads)
+		, m_job(nullptr)
+		, m_jobContext(nullptr)
+		, m_jobCount(0)
+		, m_nextJob(0)
+		, m_pendingJobs(0)
+		, m_generation(0)
+		, m_running(true)
+	{
+		// the calling thread takes a share of the work
+		for (unsigned int thread = 1; thread < m_maxThreads; ++thread)
+		{
+			m_threads.emplace_back(&WorkerThreads::runThread, this);
+		}
+	}
+
+	~WorkerThreads()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_running = false;
+		}
+		m_startCondition.notify_all();
+		for (std::thread& thread : m_threads)
+		{
+			thread.join();
+		}
+	}
+
+	unsigned int getMaxThreads() const { return m_maxThreads; }
+
+	// number of threads to split numItems between so that each has at least minItemsPerThread
+	unsigned int getThreadCount(size_t numItems, size_t minItemsPerThread) const
+	{
+		return static_cast<unsigned int>(std::clamp<size_t>(numItems / minItemsPerThread, 1, m_maxThreads));
+	}
+
+	// the items of a thread when numItems are evenly split between numThreads
+	static std::pair<size_t, size_t> getThreadRange(size_t numItems, unsigned int numThreads, unsigned int thread)
+	{
+		return { numItems * thread / numThreads, numItems * (thread + 1) / numThreads };
+	}
+
+	// calls func(thread) once for each thread index below numThreads and waits for all of them,
+	// a single thread runs on the calling thread without waking the pool
+	template <class Func>
+	void run(unsigned int numThreads, Func func)
+	{
+		if (numThreads <= 1 || m_threads.empty())
+		{
+			for (unsigned int thread = 0; thread < numThreads; ++thread)
+			{
+				func(thread);
+			}
+			return;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_job = &runJob<Func>;
+			m_jobContext = &func;
+			m_jobCount = numThreads;
+			m_nextJob = 0;
+			m_pendingJobs = numThreads;
+			++m_generation;
+		}
+		m_startCondition.notify_all();
+
+		runJobs();
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_doneCondition.wait(lock, [this]() { return m_pendingJobs == 0; });
+	}
+
+protected:
+	using Job = void (*)(void* context, unsigned int thread);
+
+	template <class Func>
+	static void runJob(void* context, unsigned int thread)
+	{
+		(*static_cast<Func*>(context))(thread);
+	}
+
+	// takes the jobs of the current call until none is left, the job is read along with its index so that
+	// a thread woken late never runs the job of a call that returned already
+	void runJobs()
+	{
+		while (true)
+		{
+			Job job;
+			void* jobContext;
+			unsigned int thread;
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				if (m_nextJob == m_jobCount)
+				{
+					return;
+				}
+				job = m_job;
+				jobContext = m_jobContext;
+				thread = m_nextJob++;
+			}
+
+			job(jobContext, thread);
+
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (--m_pendingJobs == 0)
+			{
+				m_doneCondition.notify_one();
+			}
+		}
+	}
+
+	void runThread()
+	{
+		std::uint64_t generation = 0;
+		while (true)
+		{
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_startCondition.wait(lock, [this, generation]() { return !m_running || m_generation != generation; });
+				if (!m_running)
+				{
+					return;
+				}
+				generation = m_generation;
+			}
+			runJobs();
+		}
+	}
+
+protected:
+	unsigned int m_maxThreads;
+	std::vector<std::thread> m_threads;
+
+	// the call being run, its jobs are the thread indices handed out in order
+	std::mutex m_mutex;
+	std::condition_variable m_startCondition;
+	std::condition_variable m_doneCondition;
+	Job m_job;
+	void* m_jobContext;
+	unsigned int m_jobCount;
+	unsigned int m_nextJob;
+	unsigned int m_pendingJobs;
+	std::uint64_t m_generation;
+	bool m_running;
+};